@@ -9,16 +9,40 @@ CONFIG -= app_bundle
 
 TEMPLATE = app
 
+# qmake CONFIG+=soak: also count live allocations in --soak runs (replaces global operator new)
+soak: DEFINES += SOAK_ALLOCATION_COUNT
+
 SOURCES += main.cpp \
     lo/arma_logger.cpp \
     lo/waitforsignalhelper.cpp \
     lo/vkapi.cpp \
     lo/languageprocessing.cpp \
-    lo/vkautoreplyer.cpp
+    lo/vkautoreplyer.cpp \
+    lo/traffictape.cpp \
+    lo/vkcallbackserver.cpp \
+    lo/sharedratelimiter.cpp \
+    lo/replypipeline.cpp \
+    lo/vkoutbox.cpp \
+    lo/admissioncontrol.cpp \
+    lo/peerstatetable.cpp \
+    lo/rulelayers.cpp \
+    lo/shadowevaluator.cpp \
+    lo/soakharness.cpp
 
 HEADERS += \
     lo/arma_logger.h \
     lo/waitforsignalhelper.h \
     lo/vkapi.h \
     lo/languageprocessing.h \
-    lo/vkautoreplyer.h
+    lo/vkautoreplyer.h \
+    lo/traffictape.h \
+    lo/vkcallbackserver.h \
+    lo/sharedratelimiter.h \
+    lo/spscqueue.h \
+    lo/replypipeline.h \
+    lo/vkoutbox.h \
+    lo/admissioncontrol.h \
+    lo/peerstatetable.h \
+    lo/rulelayers.h \
+    lo/shadowevaluator.h \
+    lo/soakharness.h
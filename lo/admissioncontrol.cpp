@@ -0,0 +1,113 @@
+#include "admissioncontrol.h"
+#include <QDateTime>
+
+using namespace vk_api;
+
+// served counters are forgotten after that, ms
+static const qint64 fairnessWindowMs = 60 * 1000;
+
+ReplyTask::ReplyTask():
+    priority(0),
+    hasNext(false),
+    next(0)
+{
+}
+
+AdmissionPolicy::AdmissionPolicy():
+    maxAgeSec(0),
+    newestFirst(false),
+    perPeerFairness(false),
+    maxPending(10000)
+{
+}
+
+AdmissionController::AdmissionController(const AdmissionPolicy &policy):
+    policy_(policy),
+    shedCount_(0)
+{
+    fairnessWindow_.start();
+}
+
+void AdmissionController::setPolicy(const AdmissionPolicy &policy)
+{
+    policy_ = policy;
+}
+
+QList<ReplyTask> AdmissionController::offer(const ReplyTask &task)
+{
+    QList<ReplyTask> shed;
+    pending_.push_back(task);
+
+    if (policy_.maxPending > 0 && pending_.size() > policy_.maxPending)
+    {
+        int worst = 0;
+        for (int i = 1; i < pending_.size(); ++i)
+            if (before(pending_[worst], pending_[i]))
+                worst = i;
+        shed.push_back(pending_.takeAt(worst));
+        shedCount_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return shed;
+}
+
+bool AdmissionController::take(ReplyTask &task, QList<ReplyTask> &shed)
+{
+    if (policy_.maxAgeSec > 0)
+    {
+        const qint64 oldest = QDateTime::currentMSecsSinceEpoch() / 1000 - policy_.maxAgeSec;
+        const int alreadyShed = shed.size();
+        for (int i = pending_.size() - 1; i >= 0; --i)
+            if (pending_[i].message.date < oldest)
+                shed.push_back(pending_.takeAt(i));
+        // shed may already hold replies counted by offer()
+        shedCount_.fetch_add(shed.size() - alreadyShed, std::memory_order_relaxed);
+    }
+
+    if (pending_.isEmpty())
+        return false;
+
+    if (fairnessWindow_.elapsed() > fairnessWindowMs)
+    {
+        servedByPeer_.clear();
+        fairnessWindow_.restart();
+    }
+
+    int best = 0;
+    for (int i = 1; i < pending_.size(); ++i)
+        if (before(pending_[i], pending_[best]))
+            best = i;
+
+    task = pending_.takeAt(best);
+    if (policy_.perPeerFairness)
+        ++servedByPeer_[task.message.userId];
+    return true;
+}
+
+int AdmissionController::size() const
+{
+    return pending_.size();
+}
+
+qint64 AdmissionController::shedCount() const
+{
+    return shedCount_.load(std::memory_order_relaxed);
+}
+
+bool AdmissionController::before(const ReplyTask &a, const ReplyTask &b) const
+{
+    if (a.priority != b.priority)
+        return a.priority > b.priority;
+
+    if (policy_.perPeerFairness)
+    {
+        const int servedA = servedByPeer_.value(a.message.userId);
+        const int servedB = servedByPeer_.value(b.message.userId);
+        if (servedA != servedB)
+            return servedA < servedB;
+    }
+
+    if (a.message.date != b.message.date)
+        return policy_.newestFirst ? a.message.date > b.message.date : a.message.date < b.message.date;
+
+    return policy_.newestFirst ? a.message.id > b.message.id : a.message.id < b.message.id;
+}
@@ -0,0 +1,91 @@
+/** \file      admissioncontrol.h
+ *  \brief     Decides which replies get sent when there are more than the rate limit allows
+ */
+#ifndef ADMISSIONCONTROL_H
+#define ADMISSIONCONTROL_H
+
+#include <QList>
+#include <QHash>
+#include <QElapsedTimer>
+#include <atomic>
+#include "vkapi.h"
+
+/// \brief reply generated for a message, passed from match to send stage
+struct ReplyTask
+{
+    ReplyTask();
+
+    vk_api::VkMessage message;
+    QString reply;
+
+    /// priority of the rule that produced the reply; higher is sent first
+    int priority;
+
+    /// conversation state the peer moves to once the reply is admitted to the outbox
+    bool hasNext;
+    quint16 next;
+};
+
+/// \brief settings of AdmissionController
+struct AdmissionPolicy
+{
+    AdmissionPolicy();
+
+    /// replies to messages older than that (seconds) are dropped; 0 - no limit
+    int maxAgeSec;
+
+    /// answer newest messages first instead of oldest first
+    bool newestFirst;
+
+    /// among replies of equal priority prefer peers who got fewer replies recently
+    bool perPeerFairness;
+
+    /// max amount of replies waiting to be admitted; lowest-ranked are dropped on overflow
+    int maxPending;
+};
+
+/**
+ * @brief The AdmissionController class stands in front of the outbox.
+ * Replies are offered as they're generated and taken one at a time when the outbox is ready to send;
+ * replies that can't be served in time, or don't fit, are shed: the message is left unanswered.
+ * Not thread-safe: belongs to the send stage.
+ */
+class AdmissionController
+{
+public:
+    explicit AdmissionController(const AdmissionPolicy& policy = AdmissionPolicy());
+
+    void setPolicy(const AdmissionPolicy& policy);
+
+    /// \returns tasks shed because of overflow (at most one)
+    QList<ReplyTask> offer(const ReplyTask& task);
+
+    /**
+     * @brief take picks the best pending reply according to the policy
+     * @param task receives picked reply
+     * @param shed receives replies dropped as too old
+     * @return false if there's nothing to send
+     */
+    bool take(ReplyTask& task, QList<ReplyTask>& shed);
+
+    int size() const;
+
+    /// \returns total amount of shed replies; may be called from any thread
+    qint64 shedCount() const;
+
+private:
+    /// \returns true if a should be sent before b
+    bool before(const ReplyTask& a, const ReplyTask& b) const;
+
+    AdmissionPolicy policy_;
+
+    QList<ReplyTask> pending_;
+
+    // peer id -> replies admitted in the current fairness window
+    QHash<qint32, int> servedByPeer_;
+    QElapsedTimer fairnessWindow_;
+
+    std::atomic<qint64> shedCount_;
+};
+
+#endif // ADMISSIONCONTROL_H
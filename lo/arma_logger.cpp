@@ -4,6 +4,7 @@
 #include <QFile>
 #include <QJsonObject>
 #include <QJsonDocument>
+#include <QMutex>
 
 #include <iostream>
 
@@ -55,6 +56,10 @@ void log(const QVariant& variant, LoggingPriority priority)
     if (priority < LoggingOptions::minimalPriority)
         return;
 
+    // pipeline stages log from their own threads; keep lines whole
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+
     if (LoggingOptions::detalization == ldTime)
         std::cout << QDateTime::currentDateTime().toString("hh:mm.zzz ").toStdString();
 
@@ -106,13 +111,18 @@ bool setLoggingOptions(LoggingPriority _minimalPriority,
     return true;
 }
 
-QVariant jsonStringToVariant(const QByteArray& jsonString)
+QJsonDocument jsonStringToDocument(const QByteArray& jsonString)
 {
     QJsonParseError e;
     QJsonDocument doc = QJsonDocument::fromJson(jsonString, &e);
     if (e.error != QJsonParseError::NoError)
         log("error parsing json: " + e.errorString(), lpError);
-    return doc.toVariant();
+    return doc;
+}
+
+QVariant jsonStringToVariant(const QByteArray& jsonString)
+{
+    return jsonStringToDocument(jsonString).toVariant();
 }
 
 QVariantMap jsonStringToMap(const QByteArray& jsonString)
@@ -7,6 +7,7 @@
 #define ARMA_LOGGER_H
 
 #include <QDebug>
+#include <QJsonDocument>
 
 namespace arma_logger
 {
@@ -71,6 +72,9 @@ QVariantMap jsonStringToMap(const QByteArray& jsonString);
 /// converts json string to QVariant
 QVariant jsonStringToVariant(const QByteArray& jsonString);
 
+/// parses json string without converting it to QVariant tree
+QJsonDocument jsonStringToDocument(const QByteArray& jsonString);
+
 /// \returns string with special characters added, which allow to display colored string in colnsole
 QString wrapColor(const QString& s, Qt::GlobalColor color);
 
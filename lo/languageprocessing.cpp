@@ -1,6 +1,10 @@
 #include "languageprocessing.h"
 #include <lo/arma_logger.h>
 #include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <algorithm>
+#include <random>
 
 int findOpenBracket(const QString& pattern, int closeBracketIndex,
                     QChar openBracketChar, QChar closeBracketChar)
@@ -17,10 +21,27 @@ int findOpenBracket(const QString& pattern, int closeBracketIndex,
     return j;
 }
 
+static std::mt19937& randomEngine()
+{
+    static std::mt19937 engine;
+    return engine;
+}
+
+void loLangSetSeed(quint32 seed)
+{
+    randomEngine().seed(seed);
+}
+
+/// \returns random number in [0, n)
+static int randomInt(int n)
+{
+    return int(randomEngine()() % quint32(n));
+}
+
 QString simplifyInBrackets(const QString& s, QChar splitChar)
 {
     QStringList list = s.split(splitChar);
-    int index = rand() % list.size();
+    int index = randomInt(list.size());
     return list[index];
 }
 
@@ -44,7 +65,7 @@ QString loLangGenerate(QString pattern)
         {
             // remove questionmark
             pattern.remove(c+1, 1);
-            if (rand() % 2)
+            if (randomInt(2))
                 simplified = "";
         }
         pattern.replace(o, c-o+1, simplified);
@@ -62,41 +83,424 @@ QString loLangGenerate(QString pattern)
         pattern.remove(i, 1);
 
         // removing char
-        if (i != 0 && qrand() % 2)
+        if (i != 0 && randomInt(2))
             pattern.remove(i-1, 1); // remove char
     }
     return pattern.replace("⍰", "?");
 }
 
-QString loLangGetReply(const QString &input, const QString &repliesfilePath)
+/// \brief conversation state names shared by all rule sets
+struct StateRegistry
+{
+    QMutex mutex;
+    QHash<QString, quint16> ids;
+    // index is id - 1
+    QStringList names;
+};
+
+static StateRegistry& stateRegistry()
+{
+    static StateRegistry registry;
+    return registry;
+}
+
+// normalization table values which are not characters
+static const uint ncStrip = 0;     // character is dropped
+static const uint ncSeparator = 1; // character is replaced by a single space
+// flag of letters, the only characters whose runs are squeezed
+static const uint ncLetter = 0x10000;
+
+/// \returns table mapping each UTF-16 code unit to its normalized form (low 16 bits) and flags
+static const uint* normalizationTable()
+{
+    static const QVector<uint> table = []() {
+        QVector<uint> t(0x10000);
+        for (int u = 0; u < 0x10000; ++u)
+        {
+            const QChar c(u);
+            uint mapped = ncStrip;
+
+            if (c.isSurrogate())
+                mapped = ncStrip; // characters outside BMP: emoji, pictographs
+            else if (c.isSpace() || c.isPunct())
+                mapped = ncSeparator;
+            else if (c.isLetterOrNumber())
+                mapped = c.toCaseFolded().unicode();
+            // marks, symbols, control and format characters (variation selectors, ZWJ) are dropped
+
+            // ё -> е
+            if (mapped == 0x0451)
+                mapped = 0x0435;
+
+            if (c.isLetter())
+                mapped |= ncLetter;
+
+            t[u] = mapped;
+        }
+        return t;
+    }();
+    return table.constData();
+}
+
+QString loLangNormalize(const QString &input)
+{
+    const uint* table = normalizationTable();
+
+    QString result(input.size(), Qt::Uninitialized);
+    ushort* out = reinterpret_cast<ushort*>(result.data());
+    const ushort* in = input.utf16();
+    const ushort* end = in + input.size();
+
+    int n = 0, run = 0;
+    ushort last = ' ';
+
+    for (; in != end; ++in)
+    {
+        const uint entry = table[*in];
+
+        if (entry == ncStrip)
+            continue;
+
+        if (entry == ncSeparator)
+        {
+            // collapse separator runs, skip leading separators
+            if (last != ' ')
+                out[n++] = last = ' ';
+            continue;
+        }
+
+        const ushort c = ushort(entry);
+
+        if (c == last && (entry & ncLetter))
+        {
+            // squeeze runs of 3 and more equal letters: "приииивет" -> "привет", "hello" and "1000" stay
+            if (++run == 3)
+                --n;
+            if (run >= 3)
+                continue;
+        }
+        else
+        {
+            run = 1;
+        }
+        out[n++] = last = c;
+    }
+
+    if (n > 0 && out[n - 1] == ' ')
+        --n;
+
+    result.resize(n);
+    return result;
+}
+
+quint16 loLangStateId(const QString &name)
+{
+    if (name.isEmpty())
+        return 0;
+
+    StateRegistry& registry = stateRegistry();
+    QMutexLocker locker(&registry.mutex);
+    auto i = registry.ids.constFind(name);
+    if (i != registry.ids.constEnd())
+        return *i;
+
+    // ids are 16-bit; running out is a patterns problem, not something to wrap around
+    if (registry.names.size() >= 0xffff)
+    {
+        log("too many conversation states, state " + name + " is rejected", arma_logger::lpError);
+        return 0;
+    }
+
+    registry.names.push_back(name);
+    const quint16 id = quint16(registry.names.size());
+    registry.ids.insert(name, id);
+    return id;
+}
+
+QString loLangStateName(quint16 id)
+{
+    StateRegistry& registry = stateRegistry();
+    QMutexLocker locker(&registry.mutex);
+    return (id == 0 || id > registry.names.size()) ? QString() : registry.names[id - 1];
+}
+
+LoLangInput::LoLangInput(const QString &input, bool withLowered):
+    normalized(loLangNormalize(input)),
+    lowered(withLowered ? input.toLower() : QString())
+{
+}
+
+LoLangRuleSet::LoLangRuleSet(const QString &repliesFilePath, int cacheSize):
+    path_(repliesFilePath),
+    lastSize_(-1),
+    hasRawRules_(false),
+    hasStateRules_(false),
+    matchCache_(cacheSize)
+{
+    load();
+}
+
+bool LoLangRuleSet::reloadIfChanged()
+{
+    QFileInfo info(path_);
+    if (info.lastModified() == lastModified_ && info.size() == lastSize_)
+        return true;
+
+    log("reloading patterns file " + path_, arma_logger::lpInfo);
+    return load();
+}
+
+bool LoLangRuleSet::load()
 {
     const QString splitter = "%";
-    const QString phraseLower = input.toLower();
 
-    QFile file(repliesfilePath);
+    QFile file(path_);
     if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
     {
-        log("cann\'t open patterns file " + repliesfilePath, arma_logger::lpError);
-        return "";
+        log("cann\'t open patterns file " + path_, arma_logger::lpError);
+        return false;
     }
 
+    QFileInfo info(file);
+    lastModified_ = info.lastModified();
+    lastSize_ = info.size();
+
+    rules_.clear();
+    matchCache_.clear();
+    trigramIndex_.clear();
+    hasRawRules_ = false;
+    hasStateRules_ = false;
+
     while (!file.atEnd()) {
         QString line = file.readLine();
+        if (line.endsWith('\n'))
+            line.chop(1);
+        if (line.isEmpty())
+            continue;
+
         QStringList parts = line.split(splitter);
-        if (parts.size() != 2)
+        if (parts.size() != 2 && parts.size() != 3)
         {
             log("cant split line: " + line, arma_logger::lpWarn);
-            return "";
+            continue;
         }
-        QRegExp regex(parts[0]);
-        QString reply = parts[1];
-        if (reply[reply.size() - 1] == '\n')
-            reply = reply.mid(0, reply.size() - 1);
 
-        if (regex.indexIn(phraseLower) != -1)
-            return loLangGenerate(reply);
+        LoLangRule rule;
+        rule.reply = parts[1];
+        rule.raw = false;
+        rule.priority = 0;
+        rule.state = 0;
+        rule.hasNext = false;
+        rule.next = 0;
+        rule.fuzzy = false;
+        rule.threshold = 0.5;
+        rule.trigramCount = 0;
+
+        bool optionsValid = true;
+        const QStringList options = parts.value(2).split(',', QString::SkipEmptyParts);
+        for (const QString& option: options)
+        {
+            if (!parseRuleOption(rule, option.trimmed()))
+            {
+                log("invalid rule option \"" + option + "\" in line: " + line, arma_logger::lpWarn);
+                optionsValid = false;
+            }
+        }
+        if (!optionsValid)
+            continue;
+
+        if (rule.fuzzy)
+        {
+            rule.trigramCount = addToTrigramIndex(loLangNormalize(parts[0]), rules_.size());
+        }
+        else
+        {
+            rule.regex = QRegExp(parts[0]);
+            if (!rule.regex.isValid())
+            {
+                log("invalid regex: " + parts[0] + " (" + rule.regex.errorString() + ")", arma_logger::lpWarn);
+                continue;
+            }
+        }
+
+        hasRawRules_ = hasRawRules_ || rule.raw;
+        hasStateRules_ = hasStateRules_ || rule.state != 0;
+        rules_.push_back(rule);
+    }
+
+    log("loaded " + QString::number(rules_.size()) + " rules from " + path_, arma_logger::lpDebug);
+    return true;
+}
+
+int LoLangRuleSet::match(const QString &input, quint16 state)
+{
+    // raw rules see lowered phrase, so it has to be a part of the key then
+    const LoLangInput phrase(input, hasRawRules_);
+    QString key = hasRawRules_ ? phrase.lowered : phrase.normalized;
+
+    // result depends on state only if some rules do; then every key starts with the state,
+    // including 0, so a raw phrase starting with e.g. a tab doesn't look like state 9
+    if (!hasStateRules_)
+        state = 0;
+    else
+        key.prepend(QChar(state));
+
+    if (int* cached = matchCache_.object(key))
+        return *cached;
+
+    int index = matchUncached(phrase, state);
+    matchCache_.insert(key, new int(index));
+    return index;
+}
+
+int LoLangRuleSet::matchUncached(const LoLangInput &phrase, quint16 state)
+{
+    // fuzzy rules are looked up in the index, regexes after the first fuzzy hit don't matter
+    const int fuzzyIndex = matchFuzzy(phrase.normalized, state);
+    const int end = (fuzzyIndex == -1) ? rules_.size() : fuzzyIndex;
+
+    for (int i = 0; i < end; ++i)
+    {
+        if (rules_[i].fuzzy || !appliesIn(rules_[i], state))
+            continue;
+        const QString& text = rules_[i].raw ? phrase.lowered : phrase.normalized;
+        if (rules_[i].regex.indexIn(text) != -1)
+            return i;
     }
 
     // no regex satisfies input phrase
-    return "";
+    return fuzzyIndex;
+}
+
+/// \returns sorted unique trigrams of the phrase padded with spaces, each packed into 48 bits
+static QVector<quint64> trigrams(const QString& phrase)
+{
+    QVector<quint64> result;
+    if (phrase.isEmpty())
+        return result;
+
+    const QString padded = ' ' + phrase + ' ';
+    const ushort* s = padded.utf16();
+    result.reserve(padded.size() - 2);
+    for (int i = 0; i + 2 < padded.size(); ++i)
+        result.push_back(quint64(s[i]) << 32 | quint64(s[i+1]) << 16 | quint64(s[i+2]));
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+int LoLangRuleSet::addToTrigramIndex(const QString &phrase, int ruleIndex)
+{
+    const QVector<quint64> grams = trigrams(phrase);
+    for (quint64 g: grams)
+        trigramIndex_[g].push_back(ruleIndex);
+    return grams.size();
+}
+
+bool LoLangRuleSet::appliesIn(const LoLangRule &rule, quint16 state) const
+{
+    return rule.state == 0 || rule.state == state;
+}
+
+int LoLangRuleSet::matchFuzzy(const QString &phrase, quint16 state) const
+{
+    if (trigramIndex_.isEmpty())
+        return -1;
+
+    const QVector<quint64> grams = trigrams(phrase);
+
+    // rule index -> amount of trigrams shared with the phrase; only rules sharing trigrams get here
+    QHash<int, int> shared;
+    for (quint64 g: grams)
+    {
+        auto postings = trigramIndex_.constFind(g);
+        if (postings != trigramIndex_.constEnd())
+            for (int ruleIndex: *postings)
+                ++shared[ruleIndex];
+    }
+
+    int best = -1;
+    for (auto i = shared.cbegin(); i != shared.cend(); ++i)
+    {
+        const LoLangRule& rule = rules_[i.key()];
+        if (!appliesIn(rule, state))
+            continue;
+        // Dice coefficient
+        const double similarity = 2.0 * i.value() / (grams.size() + rule.trigramCount);
+        if (similarity >= rule.threshold && (best == -1 || i.key() < best))
+            best = i.key();
+    }
+    return best;
+}
+
+bool LoLangRuleSet::parseRuleOption(LoLangRule &rule, const QString &option)
+{
+    const QString name = option.section('=', 0, 0);
+    const QString value = option.section('=', 1);
+
+    if (name == "raw" && value.isEmpty())
+    {
+        rule.raw = true;
+        return true;
+    }
+
+    if (name == "priority")
+    {
+        bool ok = false;
+        rule.priority = value.toInt(&ok);
+        return ok;
+    }
+
+    if (name == "state" && !value.isEmpty())
+    {
+        rule.state = loLangStateId(value);
+        return rule.state != 0;
+    }
+
+    if (name == "next" && option.contains('='))
+    {
+        rule.hasNext = true;
+        rule.next = loLangStateId(value);
+        return value.isEmpty() || rule.next != 0;
+    }
+
+    if (name == "fuzzy")
+    {
+        rule.fuzzy = true;
+        if (value.isEmpty())
+            return true;
+        bool ok = false;
+        rule.threshold = value.toDouble(&ok);
+        return ok && rule.threshold > 0 && rule.threshold <= 1;
+    }
+
+    return false;
+}
+
+QString LoLangRuleSet::reply(const QString &input)
+{
+    int index = match(input);
+    return (index == -1) ? QString() : loLangGenerate(rules_[index].reply);
+}
+
+int LoLangRuleSet::size() const
+{
+    return rules_.size();
+}
+
+const LoLangRule &LoLangRuleSet::rule(int index) const
+{
+    return rules_[index];
+}
+
+QString LoLangRuleSet::path() const
+{
+    return path_;
+}
+
+QString loLangGetReply(const QString &input, const QString &repliesfilePath)
+{
+    LoLangRuleSet rules(repliesfilePath, 0);
+    return rules.reply(input);
 }
@@ -2,6 +2,11 @@
 #define LANGUAGEPROCESSING_H
 
 #include <QString>
+#include <QRegExp>
+#include <QVector>
+#include <QCache>
+#include <QHash>
+#include <QDateTime>
 
 /// \brief generates phrase using loLanguale
 /// loLang rules:
@@ -10,6 +15,118 @@
 /// * to use questionmark as a part of a phrase, duplicate it: "{A|a}re you there??" -> "Are you there?" or "are you there?"
 QString loLangGenerate(QString pattern);
 
+/// \brief seeds random generator used by loLangGenerate; same seed gives same replies
+void loLangSetSeed(quint32 seed);
+
+/// \brief brings input phrase to the form rules are matched against in a single table-driven pass:
+/// * case folding, ё -> е
+/// * punctuation and whitespace runs become a single space, leading and trailing ones are removed
+/// * emoji, symbols and combining marks are removed
+/// * runs of 3 and more equal letters are squeezed to one: "приииивет" -> "привет"; digits are kept as is
+QString loLangNormalize(const QString& input);
+
+/// \returns id of conversation state name, same for all rule sets; 0 for empty name (no conversation)
+/// and for new names once all 65535 ids are taken
+quint16 loLangStateId(const QString& name);
+
+/// \returns conversation state name by id
+QString loLangStateName(quint16 id);
+
+/// \brief forms of an incoming phrase computed once and shared by all rules
+struct LoLangInput
+{
+    /// \param withLowered also compute lowered form (needed only if there are raw rules)
+    explicit LoLangInput(const QString& input, bool withLowered = true);
+
+    QString normalized;
+    QString lowered;
+};
+
+/// \brief single "regex%reply[%options]" line of the patterns file
+/// options are comma-separated:
+/// * raw - match regex against lowered input instead of normalized one
+/// * fuzzy[=threshold] - first field is a phrase, not a regex; rule matches messages
+///   whose trigram similarity (Dice coefficient) with the phrase is at least threshold (0.5 by default)
+/// * priority=N - when there are more replies than can be sent, higher priority ones go first (default 0)
+/// * state=NAME - rule applies only when conversation with the peer is in state NAME;
+///   rules without state apply in any state
+/// * next=NAME - after the reply conversation moves to state NAME; "next=" ends conversation.
+///   Without next, the state is kept
+struct LoLangRule
+{
+    QRegExp regex;
+    QString reply;
+    bool raw;
+    int priority;
+
+    // conversation state ids, see loLangStateId
+    quint16 state;
+    bool hasNext;
+    quint16 next;
+
+    bool fuzzy;
+    double threshold;
+    int trigramCount;
+};
+
+/// \brief LoLangRuleSet keeps rules of a patterns file in memory
+/// and remembers which rule matched recently seen phrases
+class LoLangRuleSet
+{
+public:
+    /// \param repliesFilePath path to file with regex->lolang rules
+    /// \param cacheSize amount of normalized phrases to remember match results for
+    explicit LoLangRuleSet(const QString& repliesFilePath, int cacheSize = 4096);
+
+    /// \brief re-reads patterns file if it was modified since last load; drops match cache on reload
+    /// \returns false if file can't be opened
+    bool reloadIfChanged();
+
+    /// \param state conversation state of the peer, 0 if there's no conversation
+    /// \returns index of the first rule satisfying the input phrase; -1 if there's no such rule
+    int match(const QString& input, quint16 state = 0);
+
+    /// \returns generated reply; empty string if no regex satisfies the input phrase
+    QString reply(const QString& input);
+
+    int size() const;
+
+    /// \returns rule by index returned from match()
+    const LoLangRule& rule(int index) const;
+
+    QString path() const;
+
+private:
+    bool load();
+
+    int matchUncached(const LoLangInput& phrase, quint16 state);
+
+    /// \returns index of the first fuzzy rule similar enough to the normalized phrase; -1 if none
+    int matchFuzzy(const QString& phrase, quint16 state) const;
+
+    /// \returns true if rule doesn't depend on state or is for this state
+    bool appliesIn(const LoLangRule& rule, quint16 state) const;
+
+    /// \returns amount of distinct trigrams in the phrase
+    int addToTrigramIndex(const QString& phrase, int ruleIndex);
+
+    /// \returns false if option is unknown or its value is invalid
+    static bool parseRuleOption(LoLangRule& rule, const QString& option);
+
+    QString path_;
+    QDateTime lastModified_;
+    qint64 lastSize_;
+    QVector<LoLangRule> rules_;
+    bool hasRawRules_;
+    bool hasStateRules_;
+
+    // trigram -> indices of fuzzy rules containing it
+    QHash<quint64, QVector<int>> trigramIndex_;
+
+    // [state +] normalized phrase -> rule index (-1 for phrases no rule satisfies)
+    QCache<QString, int> matchCache_;
+};
+
 /// \param repliesFilePath path to file with regex->lolang rules.
 /// \param input phrase to be replied
 /// \returns empty string if file not found or no regex satisfies the input phrase
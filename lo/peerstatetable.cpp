@@ -0,0 +1,203 @@
+#include "peerstatetable.h"
+#include "languageprocessing.h"
+#include "arma_logger.h"
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+using namespace arma_logger;
+
+static const int initialCapacity = 1024;
+static const quint32 snapshotMagic = 0x564b5053; // "VKPS"
+static const qint32 snapshotVersion = 1;
+
+PeerStateTable::PeerStateTable(int ttlSec):
+    slots_(initialCapacity, Slot{0, 0, 0, 0}),
+    mask_(initialCapacity - 1),
+    count_(0),
+    sweepPosition_(0),
+    ttlSec_(ttlSec),
+    changed_(false)
+{
+}
+
+int PeerStateTable::home(qint32 peerId) const
+{
+    // Fibonacci hashing spreads sequential ids
+    const quint32 h = quint32(peerId) * 2654435769u;
+    return int((h ^ (h >> 15)) & quint32(mask_));
+}
+
+int PeerStateTable::find(qint32 peerId) const
+{
+    int i = home(peerId);
+    while (slots_[i].peerId != 0 && slots_[i].peerId != peerId)
+        i = (i + 1) & mask_;
+    return i;
+}
+
+quint16 PeerStateTable::state(qint32 peerId, qint64 nowSec)
+{
+    const int i = find(peerId);
+    Slot& slot = slots_[i];
+    if (slot.peerId == 0)
+        return 0;
+    if (slot.expires <= nowSec)
+    {
+        erase(i);
+        return 0;
+    }
+    slot.expires = quint32(nowSec + ttlSec_);
+    changed_ = true;
+    return slot.state;
+}
+
+void PeerStateTable::setState(qint32 peerId, quint16 state, qint64 nowSec)
+{
+    if (peerId == 0)
+        return;
+
+    int i = find(peerId);
+    if (state == 0)
+    {
+        if (slots_[i].peerId != 0)
+            erase(i);
+        return;
+    }
+
+    if (slots_[i].peerId == 0)
+    {
+        // keep load factor under 0.7
+        if ((count_ + 1) * 10 > slots_.size() * 7)
+        {
+            grow();
+            i = find(peerId);
+        }
+        ++count_;
+    }
+
+    Slot& slot = slots_[i];
+    slot.peerId = peerId;
+    slot.state = state;
+    slot.expires = quint32(nowSec + ttlSec_);
+    changed_ = true;
+}
+
+void PeerStateTable::evictExpired(qint64 nowSec, int maxSlots)
+{
+    for (int n = 0; n < maxSlots && count_ > 0; ++n)
+    {
+        sweepPosition_ = (sweepPosition_ + 1) & mask_;
+        const Slot& slot = slots_[sweepPosition_];
+        // after erase another entry may have shifted into this slot, it's checked on the next pass
+        if (slot.peerId != 0 && slot.expires <= nowSec)
+            erase(sweepPosition_);
+    }
+}
+
+int PeerStateTable::size() const
+{
+    return count_;
+}
+
+bool PeerStateTable::isChanged() const
+{
+    return changed_;
+}
+
+void PeerStateTable::erase(int index)
+{
+    int hole = index;
+    int i = (index + 1) & mask_;
+    while (slots_[i].peerId != 0)
+    {
+        // entry may move into the hole only if the hole lies between its home and its position
+        const int h = home(slots_[i].peerId);
+        if (((i - h) & mask_) >= ((i - hole) & mask_))
+        {
+            slots_[hole] = slots_[i];
+            hole = i;
+        }
+        i = (i + 1) & mask_;
+    }
+    slots_[hole] = Slot{0, 0, 0, 0};
+    --count_;
+    changed_ = true;
+}
+
+void PeerStateTable::grow()
+{
+    QVector<Slot> old = slots_;
+    slots_ = QVector<Slot>(old.size() * 2, Slot{0, 0, 0, 0});
+    mask_ = slots_.size() - 1;
+    sweepPosition_ = 0;
+
+    for (const Slot& slot: old)
+        if (slot.peerId != 0)
+            slots_[find(slot.peerId)] = slot;
+}
+
+bool PeerStateTable::save(const QString &path)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        log("can't write peer states snapshot " + path, lpError);
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << snapshotMagic << snapshotVersion << qint32(count_);
+    for (const Slot& slot: slots_)
+        if (slot.peerId != 0)
+            out << slot.peerId << loLangStateName(slot.state) << slot.expires;
+
+    if (!file.commit())
+        return false;
+    changed_ = false;
+    return true;
+}
+
+bool PeerStateTable::load(const QString &path, qint64 nowSec)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic;
+    qint32 version, count;
+    in >> magic >> version >> count;
+    if (in.status() != QDataStream::Ok || magic != snapshotMagic || version != snapshotVersion)
+    {
+        log("peer states snapshot " + path + " is not valid, ignoring it", lpWarn);
+        return false;
+    }
+
+    slots_ = QVector<Slot>(initialCapacity, Slot{0, 0, 0, 0});
+    mask_ = initialCapacity - 1;
+    count_ = 0;
+    sweepPosition_ = 0;
+
+    for (qint32 n = 0; n < count; ++n)
+    {
+        qint32 peerId;
+        QString stateName;
+        quint32 expires;
+        in >> peerId >> stateName >> expires;
+        if (in.status() != QDataStream::Ok)
+            break;
+        const quint16 state = loLangStateId(stateName);
+        if (expires <= nowSec || state == 0)
+            continue;
+        setState(peerId, state, nowSec);
+        slots_[find(peerId)].expires = expires;
+    }
+    changed_ = false;
+
+    log("restored " + QString::number(count_) + " conversations from " + path, lpInfo);
+    return true;
+}
@@ -0,0 +1,70 @@
+/** \file      peerstatetable.h
+ *  \brief     Conversation state of each peer for multi-turn rules
+ */
+#ifndef PEERSTATETABLE_H
+#define PEERSTATETABLE_H
+
+#include <QVector>
+#include <QString>
+
+/**
+ * @brief The PeerStateTable class maps peer id to conversation state (see loLangStateId).
+ * Open addressing with linear probing and backward-shift deletion, 12 bytes per slot,
+ * no allocation per entry. Entries expire after TTL: expired ones are dropped on lookup
+ * and by an incremental sweep. Table can be saved to and restored from a snapshot file.
+ */
+class PeerStateTable
+{
+public:
+    /// \param ttlSec conversation is forgotten if peer doesn't write for that long
+    explicit PeerStateTable(int ttlSec = 3600);
+
+    /// \returns state of the peer's conversation; 0 if there's none or it expired.
+    /// Lookup means the peer wrote something, so it prolongs the TTL
+    quint16 state(qint32 peerId, qint64 nowSec);
+
+    /// sets state and prolongs its TTL; state 0 ends conversation
+    void setState(qint32 peerId, quint16 state, qint64 nowSec);
+
+    /// checks up to maxSlots slots for expired entries, continuing where the previous call stopped
+    void evictExpired(qint64 nowSec, int maxSlots = 64);
+
+    int size() const;
+
+    /// \returns true if table changed since it was loaded or saved
+    bool isChanged() const;
+
+    /// writes snapshot; state names are stored, not ids
+    bool save(const QString& path);
+
+    /// replaces table contents with snapshot, skipping expired entries
+    bool load(const QString& path, qint64 nowSec);
+
+private:
+    struct Slot
+    {
+        qint32 peerId;   // 0 - empty slot; vk ids are never 0
+        quint16 state;
+        quint16 reserved;
+        quint32 expires; // unix time, seconds
+    };
+
+    /// \returns slot index of the peer or of the empty slot where it would be
+    int find(qint32 peerId) const;
+
+    int home(qint32 peerId) const;
+
+    /// empties slot and shifts following entries back so probing never meets a hole
+    void erase(int index);
+
+    void grow();
+
+    QVector<Slot> slots_;
+    int mask_;
+    int count_;
+    int sweepPosition_;
+    int ttlSec_;
+    bool changed_;
+};
+
+#endif // PEERSTATETABLE_H
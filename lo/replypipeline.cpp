@@ -0,0 +1,419 @@
+#include "replypipeline.h"
+#include "arma_logger.h"
+#include "shadowevaluator.h"
+#include "traffictape.h"
+#include <QCoreApplication>
+#include <QDateTime>
+
+using namespace arma_logger;
+using namespace vk_api;
+
+// how often conversation states are saved, ms
+static const int snapshotInterval = 60 * 1000;
+
+// poll latencies kept until someone takes them
+static const int maxPollLatencies = 100000;
+
+// longest sleep of an idle stage nobody wakes, ms
+static const int maxIdleWaitMs = 100;
+
+// amount of ignored message ids to remember
+static const int maxIgnored = 100000;
+
+bool InFlightRegistry::tryAcquire(qint32 messageId)
+{
+    QMutexLocker locker(&mutex_);
+    if (ids_.contains(messageId) || ignored_.contains(messageId))
+        return false;
+    ids_.insert(messageId);
+    return true;
+}
+
+void InFlightRegistry::release(qint32 messageId)
+{
+    QMutexLocker locker(&mutex_);
+    ids_.remove(messageId);
+}
+
+void InFlightRegistry::ignore(qint32 messageId)
+{
+    QMutexLocker locker(&mutex_);
+    ids_.remove(messageId);
+    if (ignored_.contains(messageId))
+        return;
+    ignored_.insert(messageId);
+    ignoredOrder_.enqueue(messageId);
+    if (ignoredOrder_.size() > maxIgnored)
+        ignored_.remove(ignoredOrder_.dequeue());
+}
+
+PipelineStage::PipelineStage(const QString &name):
+    name_(name),
+    processed_(0),
+    consumer_(nullptr),
+    woken_(false)
+{
+    setObjectName(name);
+}
+
+QString PipelineStage::name() const
+{
+    return name_;
+}
+
+qint64 PipelineStage::processed() const
+{
+    return processed_.load(std::memory_order_relaxed);
+}
+
+void PipelineStage::stop()
+{
+    requestInterruption();
+    wake();
+    wait();
+}
+
+void PipelineStage::wake()
+{
+    QMutexLocker locker(&wakeMutex_);
+    woken_ = true;
+    wakeCondition_.wakeOne();
+}
+
+void PipelineStage::setConsumer(PipelineStage *consumer)
+{
+    consumer_ = consumer;
+}
+
+void PipelineStage::finish()
+{
+}
+
+int PipelineStage::idleWaitMs() const
+{
+    return maxIdleWaitMs;
+}
+
+void PipelineStage::wakeConsumer()
+{
+    if (consumer_ != nullptr)
+        consumer_->wake();
+}
+
+void PipelineStage::countProcessed(int count)
+{
+    processed_.fetch_add(count, std::memory_order_relaxed);
+}
+
+void PipelineStage::run()
+{
+    while (!isInterruptionRequested())
+    {
+        if (!step())
+        {
+            // nothing to do: block until a producer pushes something or timed work is due
+            const int waitMs = qMax(1, idleWaitMs());
+            QMutexLocker locker(&wakeMutex_);
+            if (!woken_ && !isInterruptionRequested())
+                wakeCondition_.wait(&wakeMutex_, ulong(waitMs));
+            woken_ = false;
+        }
+
+        // thread has no exec() loop, so objects deleted with deleteLater() are collected here
+        QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+    }
+    finish();
+}
+
+FetchStage::FetchStage(const QString &token, int intervalMs,
+                       SpscQueue<VkMessage> &output, InFlightRegistry &inFlight):
+    PipelineStage("fetch"),
+    token_(token),
+    intervalMs_(intervalMs),
+    output_(output),
+    inFlight_(inFlight)
+{
+}
+
+QVector<qint64> FetchStage::takePollLatencies()
+{
+    QMutexLocker locker(&latencyMutex_);
+    QVector<qint64> result;
+    result.swap(pollLatencies_);
+    return result;
+}
+
+int FetchStage::idleWaitMs() const
+{
+    if (TrafficTape::isExhausted())
+        return maxIdleWaitMs;
+    // sleep until the next poll
+    return sinceLastPoll_.isValid() ? int(intervalMs_ - sinceLastPoll_.elapsed()) : 0;
+}
+
+bool FetchStage::step()
+{
+    if (sinceLastPoll_.isValid() && sinceLastPoll_.elapsed() < intervalMs_)
+        return false;
+
+    // replayed traffic is over: nothing more to poll
+    if (TrafficTape::isExhausted())
+        return false;
+
+    sinceLastPoll_.start();
+
+    // backpressure: matching is behind, messages will still be unread on the next poll
+    if (output_.size() > output_.capacity() / 2)
+    {
+        log("fetch stage: match queue is busy, skipping poll", lpTrace);
+        return false;
+    }
+
+    QElapsedTimer pollTimer;
+    pollTimer.start();
+
+    getUnreadMessages(batch_, token_);
+
+    int fetched = 0;
+    for (const VkMessage& m: batch_.messages())
+    {
+        if (!inFlight_.tryAcquire(m.id))
+            continue;
+        if (!output_.tryPush(m))
+        {
+            inFlight_.release(m.id);
+            break;
+        }
+        ++fetched;
+    }
+
+    batch_.reset();
+    countProcessed(fetched);
+    if (fetched > 0)
+        wakeConsumer();
+
+    QMutexLocker locker(&latencyMutex_);
+    if (pollLatencies_.size() < maxPollLatencies)
+        pollLatencies_.push_back(pollTimer.nsecsElapsed() / 1000);
+    return true;
+}
+
+StateTransition::StateTransition():
+    peerId(0),
+    state(0)
+{
+}
+
+MatchStage::MatchStage(const QString &loLangPath, SpscQueue<VkMessage> &input,
+                       SpscQueue<ReplyTask> &output, SpscQueue<StateTransition> &transitions,
+                       InFlightRegistry &inFlight):
+    PipelineStage("match"),
+    rules_(loLangPath),
+    input_(input),
+    output_(output),
+    transitions_(transitions),
+    inFlight_(inFlight),
+    hasPending_(false),
+    shadow_(nullptr)
+{
+}
+
+void MatchStage::setConversations(const QString &snapshotPath, int ttlSec)
+{
+    conversations_ = PeerStateTable(ttlSec);
+    conversationsPath_ = snapshotPath;
+    if (!conversationsPath_.isEmpty())
+        conversations_.load(conversationsPath_, QDateTime::currentMSecsSinceEpoch() / 1000);
+}
+
+bool MatchStage::setOverlays(const QString &manifestPath)
+{
+    return rules_.setOverlays(manifestPath);
+}
+
+void MatchStage::setShadow(ShadowEvaluator *shadow)
+{
+    shadow_ = shadow;
+}
+
+void MatchStage::finish()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch() / 1000;
+    StateTransition transition;
+    while (transitions_.tryPop(transition))
+        conversations_.setState(transition.peerId, transition.state, now);
+
+    if (!conversationsPath_.isEmpty() && conversations_.isChanged())
+        conversations_.save(conversationsPath_);
+}
+
+bool MatchStage::step()
+{
+    // output is full: hold the reply and stop taking input until send stage catches up
+    if (hasPending_)
+    {
+        if (!output_.tryPush(pending_))
+            return false;
+        wakeConsumer();
+        pending_ = ReplyTask();
+        hasPending_ = false;
+    }
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch() / 1000;
+
+    StateTransition transition;
+    while (transitions_.tryPop(transition))
+        conversations_.setState(transition.peerId, transition.state, now);
+
+    if (!sinceReloadCheck_.isValid() || sinceReloadCheck_.elapsed() > 1000)
+    {
+        rules_.reloadIfChanged();
+        sinceReloadCheck_.start();
+    }
+
+    if (!conversationsPath_.isEmpty() && (!sinceSnapshot_.isValid() || sinceSnapshot_.elapsed() > snapshotInterval))
+    {
+        // writing blocks matching, so an unchanged table isn't written again
+        if (sinceSnapshot_.isValid() && conversations_.isChanged())
+            conversations_.save(conversationsPath_);
+        sinceSnapshot_.start();
+    }
+
+    VkMessage m;
+    if (!input_.tryPop(m))
+    {
+        conversations_.evictExpired(now);
+        return false;
+    }
+
+    countProcessed();
+
+    const quint16 state = conversations_.state(m.userId, now);
+    const LoLangRule* rule = rules_.match(m.peerId(), m.body, state);
+
+    if (shadow_ != nullptr)
+    {
+        ShadowSample sample;
+        sample.body = m.body;
+        sample.peerId = m.peerId();
+        sample.state = state;
+        shadow_->offer(sample);
+    }
+
+    if (rule == nullptr)
+    {
+        inFlight_.release(m.id);
+        return true;
+    }
+
+    pending_.message = m;
+    pending_.reply = loLangGenerate(rule->reply);
+    pending_.priority = rule->priority;
+    pending_.hasNext = rule->hasNext;
+    pending_.next = rule->next;
+
+    // empty generated reply (e.g. "{Привет|}") leaves the message unread
+    if (pending_.reply.isEmpty())
+    {
+        pending_ = ReplyTask();
+        inFlight_.release(m.id);
+        return true;
+    }
+
+    hasPending_ = !output_.tryPush(pending_);
+    if (!hasPending_)
+    {
+        wakeConsumer();
+        pending_ = ReplyTask();
+    }
+    return true;
+}
+
+SendStage::SendStage(const QString &token, const QString &outboxPath, SpscQueue<ReplyTask> &input,
+                     SpscQueue<StateTransition> &transitions, InFlightRegistry &inFlight):
+    PipelineStage("send"),
+    token_(token),
+    input_(input),
+    transitions_(transitions),
+    inFlight_(inFlight),
+    outbox_(outboxPath),
+    outboxSize_(outbox_.size())
+{
+}
+
+int SendStage::outboxSize() const
+{
+    return outboxSize_.load(std::memory_order_relaxed);
+}
+
+qint64 SendStage::shedCount() const
+{
+    return admission_.shedCount();
+}
+
+void SendStage::setAdmissionPolicy(const AdmissionPolicy &policy)
+{
+    admission_.setPolicy(policy);
+}
+
+bool SendStage::step()
+{
+    bool worked = false;
+
+    // everything generated so far competes for admission
+    ReplyTask task;
+    QList<ReplyTask> shed;
+    while (input_.tryPop(task))
+    {
+        shed += admission_.offer(task);
+        countProcessed();
+        worked = true;
+    }
+
+    // admit next reply only when the outbox would send it right away,
+    // so the choice is made as late as possible
+    if (!outbox_.hasDue() && admission_.take(task, shed))
+    {
+        const VkMessage& m = task.message;
+
+        // journal the reply before marking as read: after a crash the message is either
+        // still unread or its reply is in the outbox
+        const bool added = outbox_.add(m.userId, m.id, m.body, task.reply);
+
+        // not added means the reply is already pending (e.g. restored from the journal after
+        // a crash before markAsRead); the message is marked read anyway so it isn't fetched again
+        markAsRead(m.userId, m.id, token_);
+
+        // conversation moves on only when the reply is certainly going to be sent
+        if (added && task.hasNext)
+        {
+            StateTransition transition;
+            transition.peerId = m.userId;
+            transition.state = task.next;
+            pendingTransitions_.enqueue(transition);
+        }
+
+        inFlight_.release(m.id);
+        worked = true;
+    }
+
+    // shed messages stay unread for a human to answer; don't fetch them again
+    for (const ReplyTask& t: shed)
+    {
+        inFlight_.ignore(t.message.id);
+        log("shed reply to " + QString::number(t.message.userId) + ": " + t.message.body, lpDebug);
+    }
+
+    if (!pendingTransitions_.isEmpty())
+    {
+        while (!pendingTransitions_.isEmpty() && transitions_.tryPush(pendingTransitions_.head()))
+            pendingTransitions_.dequeue();
+        wakeConsumer();
+    }
+
+    // replies are sent as fast as the rate limiter lets callMethod go
+    worked = outbox_.sendNext(token_) || worked;
+
+    outboxSize_.store(outbox_.size(), std::memory_order_relaxed);
+    return worked;
+}
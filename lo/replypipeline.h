@@ -0,0 +1,223 @@
+/** \file      replypipeline.h
+ *  \brief     Stages of the reply pipeline: fetch -> match -> send, each on its own thread
+ */
+#ifndef REPLYPIPELINE_H
+#define REPLYPIPELINE_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSet>
+#include <QQueue>
+#include <QElapsedTimer>
+#include <atomic>
+#include "vkapi.h"
+#include "languageprocessing.h"
+#include "spscqueue.h"
+#include "vkoutbox.h"
+#include "admissioncontrol.h"
+#include "peerstatetable.h"
+#include "rulelayers.h"
+
+class ShadowEvaluator;
+
+/// \brief conversation state change of a peer, passed back from send to match stage
+struct StateTransition
+{
+    StateTransition();
+
+    qint32 peerId;
+    quint16 state;
+};
+
+/**
+ * @brief The InFlightRegistry class remembers ids of messages taken into the pipeline,
+ * so a message that is still unread on the next poll isn't replied twice
+ */
+class InFlightRegistry
+{
+public:
+    /// \returns false if message is already in the pipeline
+    bool tryAcquire(qint32 messageId);
+
+    /// message left the pipeline
+    void release(qint32 messageId);
+
+    /// message left the pipeline unanswered and shouldn't be taken again
+    void ignore(qint32 messageId);
+
+private:
+    QMutex mutex_;
+    QSet<qint32> ids_;
+
+    // ignored ids; oldest are forgotten when there are too many
+    QSet<qint32> ignored_;
+    QQueue<qint32> ignoredOrder_;
+};
+
+/**
+ * @brief The PipelineStage class is a thread repeatedly calling step();
+ * when there's nothing to do it sleeps until woken by a producer or until idleWaitMs() passes
+ */
+class PipelineStage: public QThread
+{
+public:
+    explicit PipelineStage(const QString& name);
+
+    QString name() const;
+
+    /// \returns amount of items handled by the stage; may be called from any thread
+    qint64 processed() const;
+
+    /// asks thread to finish and waits for it
+    void stop();
+
+    /// \brief tells the stage there's new input; may be called from any thread
+    void wake();
+
+    /// \brief stage woken after this one pushes to its output queue; call before start
+    void setConsumer(PipelineStage* consumer);
+
+protected:
+    void run() override;
+
+    /// does a piece of work; \returns false if there was nothing to do
+    virtual bool step() = 0;
+
+    /// called on the stage thread after the last step
+    virtual void finish();
+
+    /// \returns how long to sleep when idle if nobody wakes the stage; timed work (polls, retries) relies on it
+    virtual int idleWaitMs() const;
+
+    void countProcessed(int count = 1);
+
+    void wakeConsumer();
+
+private:
+    QString name_;
+    std::atomic<qint64> processed_;
+
+    PipelineStage* consumer_;
+
+    QMutex wakeMutex_;
+    QWaitCondition wakeCondition_;
+    bool woken_;
+};
+
+/// \brief polls unread messages every interval and feeds them to the match stage
+class FetchStage: public PipelineStage
+{
+public:
+    FetchStage(const QString& token, int intervalMs,
+               SpscQueue<vk_api::VkMessage>& output, InFlightRegistry& inFlight);
+
+    /// \returns durations of polls (microseconds) since the previous call; may be called from any thread
+    QVector<qint64> takePollLatencies();
+
+protected:
+    bool step() override;
+
+    int idleWaitMs() const override;
+
+private:
+    QString token_;
+    int intervalMs_;
+    SpscQueue<vk_api::VkMessage>& output_;
+    InFlightRegistry& inFlight_;
+    QElapsedTimer sinceLastPoll_;
+
+    // messages of the current poll; storage is reused between polls
+    vk_api::VkMessageBatch batch_;
+
+    QMutex latencyMutex_;
+    QVector<qint64> pollLatencies_;
+};
+
+/// \brief finds reply for each message; messages without reply leave the pipeline here.
+/// Keeps conversation state of each peer for multi-turn rules. A peer moves to the rule's next state
+/// only when send stage admits the reply, so replies shed by admission control don't change the state
+class MatchStage: public PipelineStage
+{
+public:
+    /// \param transitions state changes of peers whose replies were admitted by send stage
+    MatchStage(const QString& loLangPath, SpscQueue<vk_api::VkMessage>& input,
+               SpscQueue<ReplyTask>& output, SpscQueue<StateTransition>& transitions,
+               InFlightRegistry& inFlight);
+
+    /**
+     * @brief setConversations must be called before the stage is started
+     * @param snapshotPath conversation states are restored from and periodically saved to this file
+     * @param ttlSec conversation is forgotten if peer doesn't write for that long
+     */
+    void setConversations(const QString& snapshotPath, int ttlSec);
+
+    /// \brief must be called before the stage is started; see LoLangLayers for manifest format
+    /// \returns false if manifest can't be read
+    bool setOverlays(const QString& manifestPath);
+
+    /// \brief every message and its reply pattern will be offered to shadow; call before start
+    void setShadow(ShadowEvaluator* shadow);
+
+protected:
+    bool step() override;
+
+    void finish() override;
+
+private:
+    // loLang patterns with overlays, re-read when files change
+    LoLangLayers rules_;
+    QElapsedTimer sinceReloadCheck_;
+
+    SpscQueue<vk_api::VkMessage>& input_;
+    SpscQueue<ReplyTask>& output_;
+    SpscQueue<StateTransition>& transitions_;
+    InFlightRegistry& inFlight_;
+
+    // reply waiting for space in the output queue
+    ReplyTask pending_;
+    bool hasPending_;
+
+    PeerStateTable conversations_;
+    QString conversationsPath_;
+    QElapsedTimer sinceSnapshot_;
+
+    ShadowEvaluator* shadow_;
+};
+
+/// \brief admits replies to the outbox, marks messages as read and sends replies from the outbox
+class SendStage: public PipelineStage
+{
+public:
+    /// \param outboxPath journal of pending sends, see VkOutbox
+    /// \param transitions receives conversation state changes of admitted replies
+    SendStage(const QString& token, const QString& outboxPath, SpscQueue<ReplyTask>& input,
+              SpscQueue<StateTransition>& transitions, InFlightRegistry& inFlight);
+
+    /// \returns amount of replies waiting to be sent; may be called from any thread
+    int outboxSize() const;
+
+    /// \returns amount of replies dropped by admission control; may be called from any thread
+    qint64 shedCount() const;
+
+    /// must be called before the stage is started
+    void setAdmissionPolicy(const AdmissionPolicy& policy);
+
+protected:
+    bool step() override;
+
+private:
+    QString token_;
+    SpscQueue<ReplyTask>& input_;
+    SpscQueue<StateTransition>& transitions_;
+    InFlightRegistry& inFlight_;
+
+    // state changes which didn't fit into transitions_
+    QQueue<StateTransition> pendingTransitions_;
+
+    AdmissionController admission_;
+    vk_api::VkOutbox outbox_;
+    std::atomic<int> outboxSize_;
+};
+
+#endif // REPLYPIPELINE_H
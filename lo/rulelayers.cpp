@@ -0,0 +1,111 @@
+#include "rulelayers.h"
+#include "arma_logger.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+
+using namespace arma_logger;
+
+LoLangLayers::LoLangLayers(const QString &basePath)
+{
+    base_ = ruleSet(basePath);
+}
+
+bool LoLangLayers::setOverlays(const QString &manifestPath)
+{
+    manifestPath_ = manifestPath;
+    return loadManifest();
+}
+
+void LoLangLayers::reloadIfChanged()
+{
+    if (!manifestPath_.isEmpty() && QFileInfo(manifestPath_).lastModified() != manifestModified_)
+        loadManifest();
+
+    for (const QSharedPointer<LoLangRuleSet>& set: sets_)
+        set->reloadIfChanged();
+}
+
+const LoLangRule *LoLangLayers::match(qint32 peerId, const QString &input, quint16 state)
+{
+    LoLangRuleSet* layers[] = { peers_.value(peerId).data(), account_.data(), base_.data() };
+
+    for (LoLangRuleSet* set: layers)
+    {
+        if (set == nullptr)
+            continue;
+        const int index = set->match(input, state);
+        if (index != -1)
+            return &set->rule(index);
+    }
+    return nullptr;
+}
+
+int LoLangLayers::overlayCount() const
+{
+    int count = 0;
+    for (const QSharedPointer<LoLangRuleSet>& set: sets_)
+        if (set != base_)
+            ++count;
+    return count;
+}
+
+bool LoLangLayers::loadManifest()
+{
+    QFile file(manifestPath_);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        log("can't open overlays file " + manifestPath_, lpError);
+        return false;
+    }
+    manifestModified_ = QFileInfo(file).lastModified();
+
+    const QDir dir = QFileInfo(manifestPath_).absoluteDir();
+    QHash<qint32, QSharedPointer<LoLangRuleSet>> peers;
+    QSharedPointer<LoLangRuleSet> account;
+
+    while (!file.atEnd())
+    {
+        const QString line = QString(file.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        const QStringList parts = line.split(QRegExp("\\s+"));
+        if (parts[0] == "peer" && parts.size() == 3 && parts[1].toInt() != 0)
+            peers.insert(parts[1].toInt(), ruleSet(dir.absoluteFilePath(parts[2])));
+        else if (parts[0] == "account" && parts.size() == 2)
+            account = ruleSet(dir.absoluteFilePath(parts[1]));
+        else
+            log("can't parse overlay line: " + line, lpWarn);
+    }
+
+    peers_ = peers;
+    account_ = account;
+
+    // forget rule sets nobody uses anymore
+    QSet<LoLangRuleSet*> inUse = { base_.data(), account_.data() };
+    for (const QSharedPointer<LoLangRuleSet>& set: peers_)
+        inUse.insert(set.data());
+    for (auto i = sets_.begin(); i != sets_.end(); )
+    {
+        if (inUse.contains(i.value().data()))
+            ++i;
+        else
+            i = sets_.erase(i);
+    }
+
+    log("loaded " + QString::number(peers_.size()) + " peer overlays, "
+        + QString::number(overlayCount()) + " distinct overlay rule sets", lpInfo);
+    return true;
+}
+
+QSharedPointer<LoLangRuleSet> LoLangLayers::ruleSet(const QString &path)
+{
+    const QFileInfo info(path);
+    const QString key = info.exists() ? info.canonicalFilePath() : info.absoluteFilePath();
+    QSharedPointer<LoLangRuleSet>& set = sets_[key];
+    if (set.isNull())
+        set.reset(new LoLangRuleSet(key));
+    return set;
+}
@@ -0,0 +1,59 @@
+/** \file      rulelayers.h
+ *  \brief     Base rule set with per-peer and per-account overlays
+ */
+#ifndef RULELAYERS_H
+#define RULELAYERS_H
+
+#include <QHash>
+#include <QSharedPointer>
+#include "languageprocessing.h"
+
+/**
+ * @brief The LoLangLayers class matches messages against overlay rule sets first, then the base one.
+ * Overlays are listed in a manifest file, one per line:
+ *   peer <peer id> <patterns file>   - rules for one user or chat (2000000000 + chat id)
+ *   account <patterns file>          - rules for every peer of this bot instance
+ * Lines starting with # are comments; relative paths are relative to the manifest.
+ * Every patterns file is loaded once, however many peers use it, and is kept across manifest reloads,
+ * so compiled rules and match caches are shared and memory doesn't grow with the number of peers.
+ */
+class LoLangLayers
+{
+public:
+    explicit LoLangLayers(const QString& basePath);
+
+    /// \returns false if manifest can't be read
+    bool setOverlays(const QString& manifestPath);
+
+    /// re-reads manifest and patterns files which changed
+    void reloadIfChanged();
+
+    /**
+     * @param peerId peer the message came from
+     * @param state conversation state of the peer
+     * @return rule from the most specific layer satisfying the input; nullptr if there's none
+     */
+    const LoLangRule* match(qint32 peerId, const QString& input, quint16 state = 0);
+
+    /// \returns amount of distinct overlay rule sets
+    int overlayCount() const;
+
+private:
+    bool loadManifest();
+
+    /// \returns loaded rule set for the file, shared if it's already used by some layer
+    QSharedPointer<LoLangRuleSet> ruleSet(const QString& path);
+
+    QSharedPointer<LoLangRuleSet> base_;
+
+    QString manifestPath_;
+    QDateTime manifestModified_;
+
+    // canonical path -> rule set
+    QHash<QString, QSharedPointer<LoLangRuleSet>> sets_;
+
+    QHash<qint32, QSharedPointer<LoLangRuleSet>> peers_;
+    QSharedPointer<LoLangRuleSet> account_;
+};
+
+#endif // RULELAYERS_H
@@ -0,0 +1,173 @@
+#include "shadowevaluator.h"
+#include "arma_logger.h"
+#include <QDateTime>
+#include <QJsonDocument>
+#include <algorithm>
+
+using namespace arma_logger;
+
+static const int shadowQueueCapacity = 4096;
+
+// how often summary is written, ms
+static const int summaryInterval = 60 * 1000;
+
+ShadowSample::ShadowSample():
+    peerId(0),
+    state(0)
+{
+}
+
+ShadowEvaluator::LatencyStats::LatencyStats():
+    total(0)
+{
+}
+
+void ShadowEvaluator::LatencyStats::add(qint64 ns)
+{
+    samples.push_back(ns);
+    total += ns;
+}
+
+QJsonObject ShadowEvaluator::LatencyStats::toJson()
+{
+    if (samples.isEmpty())
+        return QJsonObject();
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [this](int p) { return double(samples[(samples.size() - 1) * p / 100]) / 1000; };
+
+    QJsonObject result{
+        {"mean_us", double(total) / samples.size() / 1000},
+        {"p50_us", percentile(50)},
+        {"p99_us", percentile(99)},
+        {"max_us", double(samples.last()) / 1000}
+    };
+    samples.clear();
+    total = 0;
+    return result;
+}
+
+ShadowEvaluator::ShadowEvaluator(const QString &activePath, const QString &candidatePath, const QString &reportPath):
+    PipelineStage("shadow"),
+    input_(shadowQueueCapacity),
+    dropped_(0),
+    active_(activePath, 0),
+    candidate_(candidatePath, 0),
+    report_(reportPath),
+    messages_(0),
+    activeHits_(0),
+    candidateHits_(0),
+    divergent_(0)
+{
+    if (!report_.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        log("can't open shadow report " + reportPath, lpError);
+    else
+        log("shadow evaluation of " + candidatePath + ", report: " + reportPath, lpInfo);
+}
+
+bool ShadowEvaluator::offer(const ShadowSample &sample)
+{
+    if (input_.tryPush(sample))
+    {
+        wake();
+        return true;
+    }
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool ShadowEvaluator::step()
+{
+    if (!sinceSummary_.isValid())
+        sinceSummary_.start();
+    else if (sinceSummary_.elapsed() > summaryInterval)
+        writeSummary();
+
+    if (!sinceReloadCheck_.isValid() || sinceReloadCheck_.elapsed() > 1000)
+    {
+        active_.reloadIfChanged();
+        candidate_.reloadIfChanged();
+        sinceReloadCheck_.start();
+    }
+
+    ShadowSample s;
+    if (!input_.tryPop(s))
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+    const int activeIndex = active_.match(s.body, s.state);
+    const qint64 activeNs = timer.nsecsElapsed();
+    activeLatency_.add(activeNs);
+
+    timer.restart();
+    const int candidateIndex = candidate_.match(s.body, s.state);
+    const qint64 candidateNs = timer.nsecsElapsed();
+    candidateLatency_.add(candidateNs);
+
+    const bool activeMatched = activeIndex != -1;
+    const bool candidateMatched = candidateIndex != -1;
+    const QString activeReply = activeMatched ? active_.rule(activeIndex).reply : QString();
+    const QString candidateReply = candidateMatched ? candidate_.rule(candidateIndex).reply : QString();
+
+    ++messages_;
+    activeHits_ += activeMatched;
+    candidateHits_ += candidateMatched;
+
+    if (candidateMatched != activeMatched || candidateReply != activeReply)
+    {
+        ++divergent_;
+        writeRecord(QJsonObject{
+            {"type", "divergence"},
+            {"peer", s.peerId},
+            {"message", s.body},
+            {"active", activeMatched ? QJsonValue(activeReply) : QJsonValue()},
+            {"candidate", candidateMatched ? QJsonValue(candidateReply) : QJsonValue()},
+            {"latency_delta_us", double(candidateNs - activeNs) / 1000}
+        });
+    }
+
+    countProcessed();
+    return true;
+}
+
+void ShadowEvaluator::finish()
+{
+    writeSummary();
+}
+
+void ShadowEvaluator::writeRecord(const QJsonObject &record)
+{
+    if (!report_.isOpen())
+        return;
+    report_.write(QJsonDocument(record).toJson(QJsonDocument::Compact) + "\n");
+    report_.flush();
+}
+
+void ShadowEvaluator::writeSummary()
+{
+    sinceSummary_.restart();
+    if (messages_ == 0)
+        return;
+
+    const QJsonObject activeLatency = activeLatency_.toJson();
+    const QJsonObject candidateLatency = candidateLatency_.toJson();
+
+    writeRecord(QJsonObject{
+        {"type", "summary"},
+        {"time", QDateTime::currentDateTime().toString(Qt::ISODate)},
+        {"messages", double(messages_)},
+        {"dropped", double(dropped_.exchange(0))},
+        {"divergent", double(divergent_)},
+        {"active_hit_rate", double(activeHits_) / messages_},
+        {"candidate_hit_rate", double(candidateHits_) / messages_},
+        {"active_latency", activeLatency},
+        {"candidate_latency", candidateLatency},
+        {"mean_latency_delta_us", candidateLatency["mean_us"].toDouble() - activeLatency["mean_us"].toDouble()}
+    });
+
+    log("shadow: " + QString::number(divergent_) + " of " + QString::number(messages_)
+        + " replies differ", lpInfo);
+
+    messages_ = activeHits_ = candidateHits_ = divergent_ = 0;
+}
@@ -0,0 +1,81 @@
+/** \file      shadowevaluator.h
+ *  \brief     Evaluates a candidate rule set on live traffic without sending anything
+ */
+#ifndef SHADOWEVALUATOR_H
+#define SHADOWEVALUATOR_H
+
+#include <QFile>
+#include <QVector>
+#include <QJsonObject>
+#include "replypipeline.h"
+
+/// \brief message and the active rule set's decision on it, passed from match stage to shadow
+struct ShadowSample
+{
+    ShadowSample();
+
+    QString body;
+    qint32 peerId;
+    quint16 state;
+};
+
+/**
+ * @brief The ShadowEvaluator class matches every message against a candidate patterns file
+ * on its own thread and writes a report (JSON lines): a record for every message where
+ * candidate's reply pattern differs from the active one, and periodic summaries with hit rates
+ * and match latency of both rule sets. For a fair comparison both files are matched here
+ * without match cache and without overlays. Samples are dropped rather than slowing down the live pipeline.
+ */
+class ShadowEvaluator: public PipelineStage
+{
+public:
+    /**
+     * @param activePath patterns file used by the bot
+     * @param candidatePath patterns file being evaluated
+     * @param reportPath report is appended to this file
+     */
+    ShadowEvaluator(const QString& activePath, const QString& candidatePath, const QString& reportPath);
+
+    /// called from the match stage; \returns false if sample was dropped
+    bool offer(const ShadowSample& sample);
+
+protected:
+    bool step() override;
+
+    void finish() override;
+
+private:
+    struct LatencyStats
+    {
+        LatencyStats();
+        void add(qint64 ns);
+        QJsonObject toJson();
+
+        QVector<qint64> samples;
+        qint64 total;
+    };
+
+    void writeRecord(const QJsonObject& record);
+
+    void writeSummary();
+
+    SpscQueue<ShadowSample> input_;
+    std::atomic<qint64> dropped_;
+
+    LoLangRuleSet active_;
+    LoLangRuleSet candidate_;
+    QElapsedTimer sinceReloadCheck_;
+
+    QFile report_;
+    QElapsedTimer sinceSummary_;
+
+    // counters of the current summary window
+    qint64 messages_;
+    qint64 activeHits_;
+    qint64 candidateHits_;
+    qint64 divergent_;
+    LatencyStats activeLatency_;
+    LatencyStats candidateLatency_;
+};
+
+#endif // SHADOWEVALUATOR_H
@@ -0,0 +1,110 @@
+#include "sharedratelimiter.h"
+#include "arma_logger.h"
+#include <QCryptographicHash>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QThread>
+#include <chrono>
+#include <new>
+
+using namespace arma_logger;
+
+namespace vk_api {
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared rate limiter needs lock-free 64-bit atomics");
+
+static const quint32 stateMagic = 0x564b524c; // "VKRL"
+
+// reservations further ahead are treated as garbage left by a clock change
+static const qint64 maxAheadUs = 60 * 1000 * 1000;
+
+double SharedRateLimiter::requestsPerSecond_ = 3;
+
+/// steady clock is the same for all processes of the host
+static qint64 nowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+SharedRateLimiter::SharedRateLimiter(const QString &key, double requestsPerSecond):
+    memory_(key),
+    state_(&localState_),
+    intervalUs_(qint64(1000000 / requestsPerSecond))
+{
+    localState_.magic = stateMagic;
+    localState_.nextSlotUs = 0;
+
+    if (attach())
+        state_ = static_cast<SharedState*>(memory_.data());
+    else
+        log("shared memory is unavailable, rate limit is not shared between processes: "
+            + memory_.errorString(), lpWarn);
+}
+
+SharedRateLimiter::~SharedRateLimiter()
+{
+    if (memory_.isAttached())
+        memory_.detach();
+}
+
+bool SharedRateLimiter::attach()
+{
+    if (!memory_.create(sizeof(SharedState)) && memory_.error() != QSharedMemory::AlreadyExists)
+        return false;
+    if (!memory_.isAttached() && !memory_.attach())
+        return false;
+
+    // whoever comes first initializes the segment; new segments are zero-filled
+    memory_.lock();
+    void* data = memory_.data();
+    SharedState* state = static_cast<SharedState*>(data);
+    if (state->magic.load() != stateMagic)
+    {
+        state = new (data) SharedState;
+        state->nextSlotUs = 0;
+        state->magic = stateMagic;
+    }
+    memory_.unlock();
+    return true;
+}
+
+void SharedRateLimiter::acquire()
+{
+    const qint64 now = nowUs();
+    qint64 next = state_->nextSlotUs.load();
+    qint64 slot;
+
+    do {
+        slot = (next < now || next > now + maxAheadUs) ? now : next;
+    } while (!state_->nextSlotUs.compare_exchange_weak(next, slot + intervalUs_));
+
+    if (slot > now)
+        QThread::usleep(ulong(slot - now));
+}
+
+SharedRateLimiter *SharedRateLimiter::forToken(const QString &token)
+{
+    if (requestsPerSecond_ <= 0 || token.isEmpty())
+        return nullptr;
+
+    static QMutex mutex;
+    static QHash<QString, QSharedPointer<SharedRateLimiter>> limiters;
+
+    QMutexLocker locker(&mutex);
+    QSharedPointer<SharedRateLimiter>& limiter = limiters[token];
+    if (limiter.isNull())
+    {
+        const QByteArray hash = QCryptographicHash::hash(token.toUtf8(), QCryptographicHash::Sha1).toHex();
+        limiter.reset(new SharedRateLimiter("vkautoreply-rate-" + hash.left(16), requestsPerSecond_));
+    }
+    return limiter.data();
+}
+
+void SharedRateLimiter::setRequestsPerSecond(double requestsPerSecond)
+{
+    requestsPerSecond_ = requestsPerSecond;
+}
+
+} // namespace vk_api
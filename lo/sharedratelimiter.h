@@ -0,0 +1,65 @@
+/** \file      sharedratelimiter.h
+ *  \brief     Rate limiter shared by all local processes using the same Vk token
+ */
+#ifndef SHAREDRATELIMITER_H
+#define SHAREDRATELIMITER_H
+
+#include <QSharedMemory>
+#include <QString>
+#include <atomic>
+
+namespace vk_api {
+
+/**
+ * @brief The SharedRateLimiter class spaces requests made with one token by all processes on the host.
+ * State is a single "next free slot" timestamp (GCRA) in a named shared memory segment,
+ * updated with compare-and-swap, so acquiring never takes a lock. Each caller reserves
+ * the next slot in arrival order, which shares the rate fairly between processes.
+ * A crashed process holds nothing but the slots it had already reserved, so there's nothing to recover.
+ */
+class SharedRateLimiter
+{
+public:
+    /**
+     * @param key processes using the same key share the limit
+     * @param requestsPerSecond allowed request rate
+     */
+    SharedRateLimiter(const QString& key, double requestsPerSecond);
+
+    ~SharedRateLimiter();
+
+    /// blocks until request may be sent
+    void acquire();
+
+    /// \returns limiter shared by all processes using the token; nullptr if limiting is disabled
+    static SharedRateLimiter* forToken(const QString& token);
+
+    /// sets rate for limiters created by forToken; 0 disables limiting. Default is 3 requests per second
+    static void setRequestsPerSecond(double requestsPerSecond);
+
+private:
+    struct SharedState
+    {
+        std::atomic<quint32> magic;
+        // steady clock microseconds when the next request may be sent
+        std::atomic<qint64> nextSlotUs;
+    };
+
+    /// attaches to existing segment or creates it; \returns false if shared memory is unavailable
+    bool attach();
+
+    QSharedMemory memory_;
+
+    // points to shared memory or to localState_ if shared memory is unavailable
+    SharedState* state_;
+
+    SharedState localState_;
+
+    qint64 intervalUs_;
+
+    static double requestsPerSecond_;
+};
+
+} // namespace vk_api
+
+#endif // SHAREDRATELIMITER_H
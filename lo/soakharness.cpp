@@ -0,0 +1,298 @@
+#include "soakharness.h"
+#include "vkautoreplyer.h"
+#include "arma_logger.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTcpSocket>
+#include <QUrlQuery>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef Q_OS_LINUX
+#include <malloc.h>
+#include <unistd.h>
+#endif
+
+using namespace arma_logger;
+
+#ifdef SOAK_ALLOCATION_COUNT
+// objects allocated with operator new and not deleted yet, counted for the whole program:
+// leaked QObjects such as network replies show up here long before they move RSS.
+// Replacing global operator new costs every allocation an atomic add, so it is compiled
+// only into the soak build (qmake CONFIG+=soak)
+static std::atomic<qint64> liveAllocations(0);
+
+void* operator new(std::size_t size)
+{
+    void* p = std::malloc(size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    liveAllocations.fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    if (p == nullptr)
+        return;
+    liveAllocations.fetch_sub(1, std::memory_order_relaxed);
+    std::free(p);
+}
+#endif
+
+// size of the user pool fake messages come from
+static const int fakeUsers = 1000;
+
+static const char* fakePhrases[] = {
+    "привет", "Привееет!!!", "как дела?", "с днём рождения!", "кто ты, бот?",
+    "hello", "ну и погода сегодня", "хорошо", "плохо", "прeвет"
+};
+
+FakeVkApi::FakeVkApi(int messagesPerPoll, QObject *parent):
+    QObject(parent),
+    messagesPerPoll_(messagesPerPoll),
+    nextMessageId_(1),
+    sentCount_(0)
+{
+    connect(&server_, &QTcpServer::newConnection, this, &FakeVkApi::onNewConnection);
+}
+
+bool FakeVkApi::listen()
+{
+    if (!server_.listen(QHostAddress::LocalHost, 0))
+    {
+        log("fake api can't listen: " + server_.errorString(), lpError);
+        return false;
+    }
+    return true;
+}
+
+QString FakeVkApi::apiUrl() const
+{
+    return "http://127.0.0.1:" + QString::number(server_.serverPort()) + "/method/";
+}
+
+qint64 FakeVkApi::sentCount() const
+{
+    return sentCount_;
+}
+
+void FakeVkApi::onNewConnection()
+{
+    while (QTcpSocket* socket = server_.nextPendingConnection())
+    {
+        buffers_.insert(socket, QByteArray());
+        connect(socket, &QTcpSocket::readyRead, this, &FakeVkApi::onReadyRead);
+        connect(socket, &QTcpSocket::disconnected, this, &FakeVkApi::onDisconnected);
+    }
+}
+
+void FakeVkApi::onDisconnected()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    buffers_.remove(socket);
+    socket->deleteLater();
+}
+
+void FakeVkApi::onReadyRead()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    QByteArray& buffer = buffers_[socket];
+    buffer += socket->readAll();
+
+    // bot sends only GET requests, they have no body
+    int headerEnd;
+    while ((headerEnd = buffer.indexOf("\r\n\r\n")) != -1)
+    {
+        const QByteArray target = buffer.left(buffer.indexOf("\r\n")).split(' ').value(1);
+        buffer.remove(0, headerEnd + 4);
+
+        const QByteArray body = respond(target);
+        socket->write("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+                      + QByteArray::number(body.size()) + "\r\nConnection: keep-alive\r\n\r\n" + body);
+    }
+}
+
+QByteArray FakeVkApi::respond(const QByteArray &target)
+{
+    const QString path = QString(target).section('?', 0, 0);
+    const QUrlQuery query(QString(target).section('?', 1));
+    const QString method = path.section('/', -1);
+
+    QJsonObject reply;
+
+    if (method == "messages.get")
+    {
+        QJsonArray items;
+        const qint64 now = QDateTime::currentMSecsSinceEpoch() / 1000;
+        const int phrases = sizeof(fakePhrases) / sizeof(fakePhrases[0]);
+        for (int i = 0; i < messagesPerPoll_; ++i)
+        {
+            const qint32 id = nextMessageId_++;
+            items.append(QJsonObject{
+                {"id", id},
+                {"user_id", 1 + id % fakeUsers},
+                {"date", double(now)},
+                {"read_state", 0},
+                {"out", 0},
+                {"body", QString::fromUtf8(fakePhrases[id % phrases])}
+            });
+        }
+        reply["response"] = QJsonObject{{"count", items.size()}, {"items", items}};
+    }
+    else if (method == "messages.send")
+    {
+        reply["response"] = double(++sentCount_);
+    }
+    else if (method == "users.get")
+    {
+        reply["response"] = QJsonArray{QJsonObject{
+            {"id", query.queryItemValue("user_ids").toInt()},
+            {"first_name", "Soak"},
+            {"last_name", "User"}
+        }};
+    }
+    else
+    {
+        reply["response"] = 1;
+    }
+
+    return QJsonDocument(reply).toJson(QJsonDocument::Compact);
+}
+
+SoakHarness::SoakHarness(VkAutoReplyer &bot, FakeVkApi &api, qint64 durationMs, double maxDriftPercent):
+    bot_(bot),
+    api_(api),
+    durationMs_(durationMs),
+    maxDriftPercent_(maxDriftPercent)
+{
+    // about a hundred samples per run, but not more often than once a second
+    timer_.setInterval(int(qBound<qint64>(1000, durationMs / 100, 60000)));
+    connect(&timer_, &QTimer::timeout, this, &SoakHarness::sample);
+}
+
+void SoakHarness::start()
+{
+    log("soak: running for " + QString::number(durationMs_ / 1000) + " sec, sampling every "
+        + QString::number(timer_.interval() / 1000) + " sec", lpInfo);
+    elapsed_.start();
+    timer_.start();
+}
+
+void SoakHarness::sample()
+{
+    SoakSample s = currentUsage();
+
+    QVector<qint64> latencies = bot_.takePollLatencies();
+    std::sort(latencies.begin(), latencies.end());
+    s.pollP50Us = latencies.isEmpty() ? 0 : latencies[(latencies.size() - 1) / 2];
+    s.pollP99Us = latencies.isEmpty() ? 0 : latencies[(latencies.size() - 1) * 99 / 100];
+
+    samples_.push_back(s);
+
+    log("soak: rss " + QString::number(s.rssKb) + " KB, heap " + QString::number(s.heapKb)
+        + " KB, allocations " + (s.allocations < 0 ? QString("n/a") : QString::number(s.allocations))
+        + ", fds " + QString::number(s.openFds) + ", poll p50 " + QString::number(s.pollP50Us)
+        + " us, p99 " + QString::number(s.pollP99Us) + " us, replies " + QString::number(api_.sentCount()),
+        lpInfo);
+
+    if (elapsed_.elapsed() >= durationMs_)
+        finish();
+}
+
+/// \returns median of the metric over samples [begin, end)
+static qint64 median(const QVector<SoakSample>& samples, int begin, int end, qint64 SoakSample::*metric)
+{
+    QVector<qint64> values;
+    for (int i = begin; i < end; ++i)
+        values.push_back(samples[i].*metric);
+    if (values.isEmpty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+void SoakHarness::finish()
+{
+    timer_.stop();
+
+    // first fifth of the run is warm-up; baseline is the second fifth, compared with the last one
+    const int n = samples_.size();
+    const int fifth = qMax(1, n / 5);
+    if (n < 3 * fifth)
+    {
+        log("soak: too few samples to compare, run longer", lpError);
+        QCoreApplication::exit(1);
+        return;
+    }
+
+    auto baseline = [&](qint64 SoakSample::*metric) { return median(samples_, fifth, 2 * fifth, metric); };
+    auto last = [&](qint64 SoakSample::*metric) { return median(samples_, n - fifth, n, metric); };
+
+    // descriptors are compared as max over the window: a leak never goes down
+    int fdsBaseline = 0, fdsFinal = 0;
+    for (int i = fifth; i < 2 * fifth; ++i)
+        fdsBaseline = qMax(fdsBaseline, samples_[i].openFds);
+    for (int i = n - fifth; i < n; ++i)
+        fdsFinal = qMax(fdsFinal, samples_[i].openFds);
+
+    bool passed = true;
+    passed = check("rss, KB", baseline(&SoakSample::rssKb), last(&SoakSample::rssKb), 1024) && passed;
+    passed = check("heap, KB", baseline(&SoakSample::heapKb), last(&SoakSample::heapKb), 1024) && passed;
+    if (samples_.last().allocations >= 0)
+        passed = check("allocations", baseline(&SoakSample::allocations), last(&SoakSample::allocations), 1000) && passed;
+    passed = check("open fds", fdsBaseline, fdsFinal, 4) && passed;
+    passed = check("poll p50, us", baseline(&SoakSample::pollP50Us), last(&SoakSample::pollP50Us), 1000) && passed;
+    passed = check("poll p99, us", baseline(&SoakSample::pollP99Us), last(&SoakSample::pollP99Us), 5000) && passed;
+
+    log("soak: " + QString::number(api_.sentCount()) + " replies sent; "
+        + (passed ? "PASSED" : "FAILED"), passed ? lpInfo : lpError);
+
+    bot_.stop();
+    QCoreApplication::exit(passed ? 0 : 1);
+}
+
+bool SoakHarness::check(const QString &name, qint64 baseline, qint64 current, qint64 slack)
+{
+    const double allowed = baseline * (1 + maxDriftPercent_ / 100) + slack;
+    const bool ok = current <= allowed;
+    log("soak: " + name + " " + QString::number(baseline) + " -> " + QString::number(current)
+        + (ok ? "" : " (drift above " + QString::number(maxDriftPercent_) + "%)"), ok ? lpInfo : lpError);
+    return ok;
+}
+
+SoakSample SoakHarness::currentUsage()
+{
+    SoakSample s = SoakSample();
+
+#ifdef Q_OS_LINUX
+    QFile statm("/proc/self/statm");
+    if (statm.open(QIODevice::ReadOnly))
+        s.rssKb = statm.readAll().split(' ').value(1).toLongLong() * sysconf(_SC_PAGESIZE) / 1024;
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    // mallinfo is deprecated there and its int fields wrap above 2 GB
+    const struct mallinfo2 info = mallinfo2();
+    s.heapKb = qint64(info.uordblks + info.hblkhd) / 1024;
+#else
+    const struct mallinfo info = mallinfo();
+    s.heapKb = (qint64(unsigned(info.uordblks)) + qint64(unsigned(info.hblkhd))) / 1024;
+#endif
+
+    s.openFds = QDir("/proc/self/fd").entryList(QDir::NoDotAndDotDot | QDir::AllEntries | QDir::System).size();
+#endif
+
+#ifdef SOAK_ALLOCATION_COUNT
+    s.allocations = liveAllocations.load(std::memory_order_relaxed);
+#else
+    s.allocations = -1;
+#endif
+    return s;
+}
@@ -0,0 +1,108 @@
+/** \file      soakharness.h
+ *  \brief     Long-running check that memory, descriptors and latency of the bot stay flat
+ */
+#ifndef SOAKHARNESS_H
+#define SOAKHARNESS_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QVector>
+
+class QTcpSocket;
+class VkAutoReplyer;
+
+/**
+ * @brief The FakeVkApi class is a local HTTP server answering the Vk API methods the bot uses.
+ * Every messages.get returns a few new unread messages from a pool of users.
+ */
+class FakeVkApi: public QObject
+{
+    Q_OBJECT
+
+public:
+    /// \param messagesPerPoll new messages returned by every messages.get
+    explicit FakeVkApi(int messagesPerPoll = 5, QObject* parent = nullptr);
+
+    /// \returns false if server can't listen; port is chosen by the system
+    bool listen();
+
+    /// \returns url to pass to VkGlobals::setApiUrl
+    QString apiUrl() const;
+
+    qint64 sentCount() const;
+
+private slots:
+    void onNewConnection();
+
+    void onReadyRead();
+
+    void onDisconnected();
+
+private:
+    /// \returns json response for GET request target like "/method/messages.get?..."
+    QByteArray respond(const QByteArray& target);
+
+    QTcpServer server_;
+    QHash<QTcpSocket*, QByteArray> buffers_;
+
+    int messagesPerPoll_;
+    qint32 nextMessageId_;
+    qint64 sentCount_;
+};
+
+/// \brief resource usage of the process at some moment
+struct SoakSample
+{
+    qint64 rssKb;
+    qint64 heapKb;
+    qint64 allocations; // live objects allocated with operator new; -1 unless built with CONFIG+=soak
+    int openFds;
+    qint64 pollP50Us;
+    qint64 pollP99Us;
+};
+
+/**
+ * @brief The SoakHarness class runs the bot against FakeVkApi for the given time, samples
+ * RSS, heap in use, live allocations (soak build only), open file descriptors and poll latency percentiles at intervals,
+ * then compares the end of the run with its beginning (after warm-up) and quits the application
+ * with exit code 1 if any metric grew more than allowed.
+ */
+class SoakHarness: public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @param durationMs how long to run
+     * @param maxDriftPercent allowed growth of each metric
+     */
+    SoakHarness(VkAutoReplyer& bot, FakeVkApi& api, qint64 durationMs, double maxDriftPercent);
+
+    void start();
+
+private slots:
+    void sample();
+
+private:
+    /// logs comparison and quits application
+    void finish();
+
+    /// \returns true if metric stayed within allowed drift; slack is absolute growth always allowed
+    bool check(const QString& name, qint64 baseline, qint64 current, qint64 slack);
+
+    static SoakSample currentUsage();
+
+    VkAutoReplyer& bot_;
+    FakeVkApi& api_;
+    qint64 durationMs_;
+    double maxDriftPercent_;
+
+    QTimer timer_;
+    QElapsedTimer elapsed_;
+    QVector<SoakSample> samples_;
+};
+
+#endif // SOAKHARNESS_H
@@ -0,0 +1,105 @@
+/** \file      spscqueue.h
+ *  \brief     Bounded lock-free single-producer single-consumer queue
+ */
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <QVector>
+#include <atomic>
+#include <utility>
+
+/**
+ * @brief The SpscQueue class is a bounded ring buffer for passing items between two threads.
+ * Only one thread may push and only one (other) thread may pop. Neither side ever blocks:
+ * tryPush returns false when the queue is full, which is how stages apply backpressure.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+    /// \param capacity rounded up to a power of two
+    explicit SpscQueue(int capacity):
+        head_(0),
+        tail_(0),
+        highWatermark_(0)
+    {
+        int size = 1;
+        while (size < capacity)
+            size <<= 1;
+        buffer_.resize(size);
+        slots_ = buffer_.data();
+        mask_ = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /// producer side; \returns false if queue is full
+    bool tryPush(const T& value)
+    {
+        const quint64 tail = tail_.load(std::memory_order_relaxed);
+        const quint64 head = head_.load(std::memory_order_acquire);
+        if (tail - head > quint64(mask_))
+            return false;
+
+        slots_[tail & mask_] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+
+        const int depth = int(tail + 1 - head);
+        if (depth > highWatermark_.load(std::memory_order_relaxed))
+            highWatermark_.store(depth, std::memory_order_relaxed);
+        return true;
+    }
+
+    /// consumer side; \returns false if queue is empty
+    bool tryPop(T& value)
+    {
+        const quint64 head = head_.load(std::memory_order_relaxed);
+        const quint64 tail = tail_.load(std::memory_order_acquire);
+        if (head == tail)
+            return false;
+
+        T& slot = slots_[head & mask_];
+        value = std::move(slot);
+        // don't keep references to implicitly shared data in the ring
+        slot = T();
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// \returns approximate amount of items; may be called from any thread
+    int size() const
+    {
+        const quint64 head = head_.load(std::memory_order_acquire);
+        const quint64 tail = tail_.load(std::memory_order_acquire);
+        return int(tail - head);
+    }
+
+    int capacity() const
+    {
+        return mask_ + 1;
+    }
+
+    /// \returns max size observed since last call; may be called from any thread
+    int takeHighWatermark()
+    {
+        return highWatermark_.exchange(size(), std::memory_order_relaxed);
+    }
+
+private:
+    QVector<T> buffer_;
+    T* slots_;
+    int mask_;
+
+    // consumer and producer positions are kept on separate cache lines by padding rather than
+    // alignas: over-aligned types aren't allocated correctly by new before C++17
+    static const int cacheLine = 64;
+    char headPadding_[cacheLine];
+    std::atomic<quint64> head_;
+    char tailPadding_[cacheLine];
+    std::atomic<quint64> tail_;
+    char watermarkPadding_[cacheLine];
+    std::atomic<int> highWatermark_;
+};
+
+#endif // SPSCQUEUE_H
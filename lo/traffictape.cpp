@@ -0,0 +1,167 @@
+#include "traffictape.h"
+#include "arma_logger.h"
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QQueue>
+#include <QRegExp>
+#include <QThread>
+
+using namespace arma_logger;
+
+namespace vk_api {
+
+namespace {
+
+struct TapeRecord
+{
+    qint64 offsetMs;
+    qint32 latencyMs;
+    QByteArray response;
+};
+
+QMutex tapeMutex;
+QFile* recordFile = nullptr;
+QElapsedTimer recordClock;
+
+bool replaying = false;
+bool exhausted = false;
+double replaySpeed = 1;
+QElapsedTimer replayClock;
+// API method -> recorded responses in order
+QHash<QString, QQueue<TapeRecord>> replayRecords;
+
+/// \returns "messages.get" for "https://api.vk.com/method/messages.get?..."
+QString methodOf(const QString& url)
+{
+    const QString marker = "/method/";
+    int begin = url.indexOf(marker);
+    if (begin == -1)
+        return url.section('?', 0, 0);
+    begin += marker.size();
+    return url.mid(begin, url.indexOf('?', begin) - begin);
+}
+
+} // namespace
+
+bool TrafficTape::startRecording(const QString &path)
+{
+    QMutexLocker locker(&tapeMutex);
+    QFile* file = new QFile(path);
+    if (!file->open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        log("can't open traffic record file " + path, lpError);
+        delete file;
+        return false;
+    }
+    delete recordFile;
+    recordFile = file;
+    recordClock.start();
+    log("recording API traffic to " + path, lpInfo);
+    return true;
+}
+
+bool TrafficTape::startReplay(const QString &path, double speed)
+{
+    QMutexLocker locker(&tapeMutex);
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        log("can't open traffic record file " + path, lpError);
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    int count = 0;
+    while (!in.atEnd())
+    {
+        QString url;
+        QByteArray compressed;
+        TapeRecord r;
+        in >> r.offsetMs >> r.latencyMs >> url >> compressed;
+        if (in.status() != QDataStream::Ok)
+        {
+            log("traffic record file is truncated after " + QString::number(count) + " records", lpWarn);
+            break;
+        }
+        r.response = qUncompress(compressed);
+        replayRecords[methodOf(url)].enqueue(r);
+        ++count;
+    }
+
+    replaying = true;
+    exhausted = false;
+    replaySpeed = speed;
+    replayClock.start();
+    log("replaying " + QString::number(count) + " API calls from " + path, lpInfo);
+    return true;
+}
+
+bool TrafficTape::isExhausted()
+{
+    QMutexLocker locker(&tapeMutex);
+    return exhausted;
+}
+
+bool TrafficTape::isRecording()
+{
+    QMutexLocker locker(&tapeMutex);
+    return recordFile != nullptr;
+}
+
+bool TrafficTape::isReplaying()
+{
+    QMutexLocker locker(&tapeMutex);
+    return replaying;
+}
+
+void TrafficTape::record(const QString &url, const QByteArray &response, qint64 latencyMs)
+{
+    QMutexLocker locker(&tapeMutex);
+    if (recordFile == nullptr)
+        return;
+
+    QDataStream out(recordFile);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << qint64(recordClock.elapsed()) << qint32(latencyMs) << redact(url) << qCompress(response);
+    recordFile->flush();
+}
+
+QByteArray TrafficTape::replay(const QString &url)
+{
+    TapeRecord r;
+    qint64 waitMs = 0;
+    {
+        QMutexLocker locker(&tapeMutex);
+        QQueue<TapeRecord>& queue = replayRecords[methodOf(url)];
+        if (queue.isEmpty())
+        {
+            if (!exhausted)
+                log("traffic tape has no more responses for " + methodOf(url), lpInfo);
+            exhausted = true;
+            return QByteArray();
+        }
+        r = queue.dequeue();
+
+        // response is served when it arrived during recording, scaled by speed
+        if (replaySpeed > 0)
+            waitMs = qint64(r.offsetMs / replaySpeed) - replayClock.elapsed();
+    }
+
+    if (waitMs > 0)
+        QThread::msleep(ulong(waitMs));
+
+    return r.response;
+}
+
+QString TrafficTape::redact(const QString &url)
+{
+    QString result = url;
+    return result.replace(QRegExp("access_token=[^&]*"), "access_token=<redacted>");
+}
+
+} // namespace vk_api
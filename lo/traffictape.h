@@ -0,0 +1,53 @@
+/** \file      traffictape.h
+ *  \brief     Record and replay of Vk API http traffic for offline profiling
+ */
+#ifndef TRAFFICTAPE_H
+#define TRAFFICTAPE_H
+
+#include <QString>
+#include <QByteArray>
+
+namespace vk_api {
+
+/**
+ * @brief The TrafficTape class records http request/response pairs to an append-only file
+ * and serves them back instead of network.
+ * Record format (QDataStream): offset from recording start (ms), latency (ms),
+ * url with access token redacted, zlib-compressed response.
+ * On replay, responses are served per API method in the order they were recorded,
+ * each not earlier than its recorded offset (divided by speed) since replay start.
+ * Latency is recorded for analysis only; the offsets already include it.
+ */
+class TrafficTape
+{
+    TrafficTape() = delete;
+public:
+    /// every request sent with sendHttpRequest will be appended to the file
+    /// \returns false if file can't be opened
+    static bool startRecording(const QString& path);
+
+    /// responses will be served from the file, network won't be used
+    /// \param speed timing acceleration: recorded offsets are divided by speed; 0 means no delays
+    /// \returns false if file can't be read
+    static bool startReplay(const QString& path, double speed = 1);
+
+    static bool isRecording();
+
+    static bool isReplaying();
+
+    /// \returns true if replay was asked for a response the tape doesn't have
+    static bool isExhausted();
+
+    /// appends record to the file if recording
+    static void record(const QString& url, const QByteArray& response, qint64 latencyMs);
+
+    /// \returns next recorded response of the same API method as url; empty bytearray if tape is over
+    static QByteArray replay(const QString& url);
+
+    /// \returns url with access_token value replaced
+    static QString redact(const QString& url);
+};
+
+} // namespace vk_api
+
+#endif // TRAFFICTAPE_H
@@ -2,17 +2,47 @@
 #include "arma_logger.h"
 #include "languageprocessing.h"
 #include "waitforsignalhelper.h"
+#include "traffictape.h"
+#include "sharedratelimiter.h"
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QNetworkReply>
 #include <QUrlQuery>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QUrl>
+#include <QJsonArray>
 
 using namespace arma_logger;
 
 namespace vk_api {
 
+/// sends HTTP GET request over the network
+static QByteArray sendNetworkRequest(const QString &url, float timeoutSeconds) {
+    QNetworkAccessManager mgr;
+
+    QNetworkRequest req( QUrl( QString(url.toUtf8().data()) ) );
+    QNetworkReply *reply = mgr.get(req);
+
+    WaitForSignalHelper helper( mgr, SIGNAL(finished(QNetworkReply*)) );
+
+    if ( !helper.wait( timeoutSeconds * 1000 ) )
+    {
+        log("http request timeout (" + QString::number(timeoutSeconds) + " sec)", lpError);
+        return "";
+    }
+
+
+    if (reply->error() == QNetworkReply::NoError) {
+        QByteArray result = reply->readAll();
+        return result;
+    }
+    else {
+        log("failed to send HTTP request: " + reply->errorString(), lpError);
+        return "";
+    }
+}
+
 QString VkGlobals::defaultToken = "";
 
 void VkGlobals::setDefaultToken(const QString &token)
@@ -25,10 +55,27 @@ QString VkGlobals::getDefaultToken()
     return defaultToken;
 }
 
+QString VkGlobals::apiUrl = "https://api.vk.com/method/";
+
+void VkGlobals::setApiUrl(const QString &url)
+{
+    VkGlobals::apiUrl = url;
+}
+
+QString VkGlobals::getApiUrl()
+{
+    return apiUrl;
+}
+
 QVariantMap callMethod(QString method, QVariantMap params, QString appToken)
+{
+    return callMethodJson(method, params, appToken).object().toVariantMap();
+}
+
+QJsonDocument callMethodJson(QString method, QVariantMap params, QString appToken)
 {
     // composing URL
-    QString url = "https://api.vk.com/method/" + method + "?";
+    QString url = VkGlobals::getApiUrl() + method + "?";
 
     // adding GET parameters
     for (QVariantMap::const_iterator i = params.cbegin(); i != params.cend(); ++i)
@@ -53,49 +100,87 @@ QVariantMap callMethod(QString method, QVariantMap params, QString appToken)
 
     log("call method url: " + url, lpTrace);
 
+    // all local processes using the token share its rate limit; recorded traffic isn't limited
+    if (!TrafficTape::isReplaying())
+        if (SharedRateLimiter* limiter = SharedRateLimiter::forToken(appToken))
+            limiter->acquire();
+
     QByteArray response = sendHttpRequest(url);
 
     if (response.size() == 0)
-        return QVariantMap();
+        return QJsonDocument();
 
-    const QVariantMap map = arma_logger::jsonStringToMap(response);
+    const QJsonDocument doc = arma_logger::jsonStringToDocument(response);
+    const QJsonObject object = doc.object();
 
-    if (map.contains("error"))
+    if (object.contains("error"))
     {
-        QString message = map["error"].toMap()["error_msg"].toString();
+        QString message = object["error"].toObject()["error_msg"].toString();
         if (message.size() != 0)
             log(message, lpError);
         else
             log("vk method returned error: " + response, lpError);
     }
 
-    return map;
+    return doc;
 }
 
-VkMessage::VkMessage(const QVariantMap &map):
-    id(map["id"].toInt()),
-    userId(map["user_id"].toInt()),
-    dateTime(QDateTime::fromMSecsSinceEpoch(map["date"].toLongLong() * 1000L)),
-    readState(map["read_state"].toInt()),
-    out(map["out"].toInt()),
-    title(map["title"].toString()),
-    body(map["body"].toString()),
-    attachments(map["attachments"]),
-    fwd(map["fwd_messages"])
+VkMessage::VkMessage():
+    id(0),
+    userId(0),
+    chatId(0),
+    date(0),
+    readState(false),
+    out(false)
 {
 }
 
+VkMessage::VkMessage(const QJsonObject &object):
+    id(object["id"].toInt()),
+    // newer API versions (Callback API events) use from_id and text
+    userId(object.contains("user_id") ? object["user_id"].toInt() : object["from_id"].toInt()),
+    chatId(object.contains("chat_id") ? object["chat_id"].toInt()
+                                      : qMax(0, object["peer_id"].toInt() - 2000000000)),
+    date(qint64(object["date"].toDouble())),
+    readState(object["read_state"].toInt()),
+    out(object["out"].toInt()),
+    body(object.contains("body") ? object["body"].toString() : object["text"].toString()),
+    attachments_(object.value("attachments")),
+    fwd_(object.value("fwd_messages"))
+{
+}
+
+QDateTime VkMessage::dateTime() const
+{
+    return QDateTime::fromMSecsSinceEpoch(date * 1000L);
+}
+
+qint32 VkMessage::peerId() const
+{
+    return chatId != 0 ? 2000000000 + chatId : userId;
+}
+
+QVariant VkMessage::attachments() const
+{
+    return attachments_.toVariant();
+}
+
+QVariant VkMessage::fwd() const
+{
+    return fwd_.toVariant();
+}
+
 QString VkMessage::toString() const
 {
     const int preLength = 15;
     QString s;
-    s += dateTime.toString("d.MM hh:mm") + " ";
+    s += dateTime().toString("d.MM hh:mm") + " ";
     s += out ? "->" : "<-";
 
     QString preview = s.size() > preLength ? body.left(preLength - 3) + "..." : body;
     s += preview;
 
-    if (!attachments.isNull())
+    if (!attachments_.isUndefined())
         s += "<attachment>";
 
     if (!readState)
@@ -104,39 +189,79 @@ QString VkMessage::toString() const
     return s;
 }
 
-QList<VkMessage> getMessages(bool out, int offset, int count, QString appToken)
+void VkMessageBatch::reset()
 {
-    QList<VkMessage> result;
+    // since Qt 5.7 QVector::clear() keeps capacity
+    messages_.clear();
+    document_ = QJsonDocument();
+}
 
+const QVector<VkMessage> &VkMessageBatch::messages() const
+{
+    return messages_;
+}
+
+int VkMessageBatch::size() const
+{
+    return messages_.size();
+}
+
+void VkMessageBatch::setDocument(const QJsonDocument &document)
+{
+    document_ = document;
+}
+
+void VkMessageBatch::append(const QJsonObject &object)
+{
+    messages_.push_back(VkMessage(object));
+}
+
+void VkMessageBatch::append(const VkMessage &message)
+{
+    messages_.push_back(message);
+}
+
+int getMessages(VkMessageBatch &batch, bool out, int offset, int count, bool unreadOnly, QString appToken)
+{
     QVariantMap params = {
         {"out", int(out)},
         {"offset", offset},
         {"count", count},
     };
 
-    QVariantMap reply = callMethod("messages.get", params, appToken);
+    const QJsonDocument reply = callMethodJson("messages.get", params, appToken);
+    // const object: non-const operator[] would detach (deep-copy) the response
+    const QJsonObject replyObject = reply.object();
 
-    if (reply.contains("response"))
-    {
-        QVariantList qList = reply["response"].toMap()["items"].toList();
+    if (!replyObject.contains("response"))
+        return 0;
+
+    batch.setDocument(reply);
 
-        if (qList.size() == 0)
-            log("cant get messages(size=0): reply = " + mapToJsonString(reply), lpError);
+    const QJsonArray items = replyObject.value("response").toObject().value("items").toArray();
 
-        for (const QVariant& q: qList)
-            result.push_back(VkMessage(q.toMap()));
+    if (items.size() == 0)
+        log("cant get messages(size=0): reply = " + QString(reply.toJson(QJsonDocument::Compact)), lpError);
 
-        log("checked " + QString::number(result.size()) + " msg", lpTrace);
+    int appended = 0;
+    for (const QJsonValue& item: items)
+    {
+        const QJsonObject object = item.toObject();
+        // read state is checked before VkMessage is constructed, so read messages cost nothing
+        if (unreadOnly && object["read_state"].toInt())
+            continue;
+        batch.append(object);
+        ++appended;
     }
 
-    return result;
+    log("checked " + QString::number(items.size()) + " msg", lpTrace);
+
+    return appended;
 }
 
-QList<VkMessage> getUnreadMessages(QString appToken)
+int getUnreadMessages(VkMessageBatch &batch, QString appToken)
 {
-    auto l = getMessages(false, 0, 100, appToken);
-    l.erase(std::remove_if(l.begin(), l.end(), [](const VkMessage& m) {return m.readState;}), l.end());
-    return l;
+    return getMessages(batch, false, 0, 100, true, appToken);
 }
 
 bool markAsRead(int personId, int messageId, QString appToken)
@@ -171,6 +296,39 @@ int sendMessage(QString message, int personId, QString appToken)
     return res["response"].toInt();
 }
 
+SendResult sendMessage(QString message, int personId, qint32 randomId, QString appToken)
+{
+    if (message.size() == 0)
+        return srFailed;
+
+    message = QUrl::toPercentEncoding(message);
+
+    QVariantMap params = {
+        {"message", message},
+        {"user_id", personId},
+        {"random_id", randomId}
+    };
+
+    const QJsonObject res = callMethodJson("messages.send", params, appToken).object();
+
+    if (res.contains("response"))
+        return srSent;
+
+    // empty reply: timeout or network failure
+    if (!res.contains("error"))
+        return srRetry;
+
+    switch (res["error"].toObject()["error_code"].toInt()) {
+    case 1:  // unknown error
+    case 6:  // too many requests per second
+    case 9:  // flood control
+    case 10: // internal server error
+        return srRetry;
+    default:
+        return srFailed;
+    }
+}
+
 bool likeProfilePicture(int userId, QString appToken)
 {
     // 1. get person info
@@ -256,28 +414,17 @@ VkUser getUserById(int id, QString appToken)
 }
 
 QByteArray sendHttpRequest(const QString &url, float timeoutSeconds) {
-    QNetworkAccessManager mgr;
-
-    QNetworkRequest req( QUrl( QString(url.toUtf8().data()) ) );
-    QNetworkReply *reply = mgr.get(req);
+    if (TrafficTape::isReplaying())
+        return TrafficTape::replay(url);
 
-    WaitForSignalHelper helper( mgr, SIGNAL(finished(QNetworkReply*)) );
+    QElapsedTimer elapsed;
+    elapsed.start();
 
-    if ( !helper.wait( timeoutSeconds * 1000 ) )
-    {
-        log("http request timeout (" + QString::number(timeoutSeconds) + " sec)", lpError);
-        return "";
-    }
+    QByteArray result = sendNetworkRequest(url, timeoutSeconds);
 
+    TrafficTape::record(url, result, elapsed.elapsed());
 
-    if (reply->error() == QNetworkReply::NoError) {
-        QByteArray result = reply->readAll();
-        return result;
-    }
-    else {
-        log("failed to send HTTP request: " + reply->errorString(), lpError);
-        return "";
-    }
+    return result;
 }
 
 } // namespace vk_api
@@ -8,33 +8,79 @@
 #include <QTimer>
 #include <QDateTime>
 #include <QVariant>
+#include <QVector>
+#include <QJsonObject>
+#include <QJsonDocument>
 
 namespace vk_api {
 
 /**
  * @brief sendHttpRequest sends HTTP GET request
+ * Requests are recorded or served from file when TrafficTape is recording or replaying
  * @return HTTP response as bytearray; returns empty bytearray if error occured
  */
 QByteArray sendHttpRequest(const QString& url, float timeoutSeconds = 15);
 
 struct VkMessage
 {
+    VkMessage();
+
     /// construct VkMessage from vk Private Message object: https://vk.com/dev/objects/message
-    explicit VkMessage(const QVariantMap& map);
+    /// only attachments and forwarded messages are kept as json; in Qt 5 a value taken from a parsed
+    /// document shares the whole document, so a message with them keeps its response alive
+    /// until the message is destroyed. Messages without them hold no reference
+    explicit VkMessage(const QJsonObject& object);
 
     /// \returns basic info
     QString toString() const;
 
-    int id;
-    int userId;
-    QDateTime dateTime;
+    QDateTime dateTime() const;
+
+    /// \returns id of the dialog: user id or 2000000000 + chat id for group chats
+    qint32 peerId() const;
+
+    /// attachments and forwarded messages are decoded only when asked for
+    QVariant attachments() const;
+    QVariant fwd() const;
+
+    qint32 id;
+    qint32 userId;
+    qint32 chatId; // 0 if message isn't from a group chat
+    qint64 date; // unix time, seconds
     bool readState;
     bool out;
-    QString title;
     QString body;
 
-    QVariant attachments;
-    QVariant fwd;
+private:
+    QJsonValue attachments_;
+    QJsonValue fwd_;
+};
+
+/**
+ * @brief The VkMessageBatch class keeps messages of one update tick.
+ * Storage is reused between ticks: reset() drops messages but keeps allocated capacity,
+ * so steady-state polling doesn't allocate per message.
+ */
+class VkMessageBatch
+{
+public:
+    /// drops messages and the response they refer to; keeps capacity
+    void reset();
+
+    const QVector<VkMessage>& messages() const;
+
+    int size() const;
+
+    /// stores response document the messages are referring to
+    void setDocument(const QJsonDocument& document);
+
+    void append(const QJsonObject& object);
+
+    void append(const VkMessage& message);
+
+private:
+    QJsonDocument document_;
+    QVector<VkMessage> messages_;
 };
 
 struct VkUser
@@ -54,17 +100,24 @@ struct VkUser
 class VkGlobals
 {
     static QString defaultToken;
+    static QString apiUrl;
 public:
     /// setups application token that would be used as default argument
     static void setDefaultToken(const QString& token);
 
     static QString getDefaultToken();
+
+    /// setups url methods are called at, "https://api.vk.com/method/" by default
+    static void setApiUrl(const QString& url);
+
+    static QString getApiUrl();
 };
 
 
 /**
  * @brief callMethod calls method specified in VK API documentation
  * example call: vk_api::callMethod("messages.get", {{"out", 0}, {"count", 10}})
+ * blocks if token's rate limit (shared by all local processes) is exhausted, see SharedRateLimiter
  * @param method method name
  * @param params method parameters for http request
  * @param appToken application token
@@ -73,21 +126,31 @@ public:
  */
 QVariantMap callMethod(QString method, QVariantMap params, QString appToken = VkGlobals::getDefaultToken());
 
+/**
+ * @brief callMethodJson same as callMethod, but doesn't convert reply to QVariant tree
+ * @returns empty document if http request failed
+ */
+QJsonDocument callMethodJson(QString method, QVariantMap params, QString appToken = VkGlobals::getDefaultToken());
+
 /**
  * @brief getMessages calls messages.get vk method
+ * @param batch messages are appended to it
  * @param out true, if need to obtain outcome messages
  * @param offset messages id offset
  * @param count amount of messages to get (max. 100)
+ * @param unreadOnly skip messages with readState==true without decoding them
  * @param appToken application token
- * @return list of VkMessage objects
+ * @return amount of messages appended
  */
-QList<VkMessage> getMessages(bool out = false, int offset = 0, int count = 20, QString appToken = VkGlobals::getDefaultToken());
+int getMessages(VkMessageBatch& batch, bool out = false, int offset = 0, int count = 20,
+                bool unreadOnly = false, QString appToken = VkGlobals::getDefaultToken());
 
 /**
  * @brief getUnreadMessages checks last 100 incoming messages and searches for unread
- * @return list of VkMessage objects with readState==false
+ * @param batch VkMessage objects with readState==false are appended to it
+ * @return amount of messages appended
  */
-QList<VkMessage> getUnreadMessages(QString appToken = VkGlobals::getDefaultToken());
+int getUnreadMessages(VkMessageBatch& batch, QString appToken = VkGlobals::getDefaultToken());
 
 /**
  * @brief markAsRead marks message as read
@@ -105,6 +168,21 @@ bool markAsRead(int personId, int messageId, QString appToken = VkGlobals::getDe
  */
 int sendMessage(QString message, int personId, QString appToken = VkGlobals::getDefaultToken());
 
+enum SendResult
+{
+    srSent,   // message is sent
+    srRetry,  // network failure or temporary vk error; same request may be repeated
+    srFailed  // vk refused the message; repeating won't help
+};
+
+/**
+ * @brief sendMessage sends text message to a user once
+ * @param randomId idempotency key: vk won't send a message with the same random_id twice,
+ * so the request may be safely repeated after a timeout
+ * @return whether message was sent and, if not, whether it's worth retrying
+ */
+SendResult sendMessage(QString message, int personId, qint32 randomId, QString appToken = VkGlobals::getDefaultToken());
+
 /**
  * @brief likeProfilePicture adds "like" to person's profile photo
  * @param userId id of user whose photo we will like
@@ -116,4 +194,6 @@ VkUser getUserById(int id, QString appToken = VkGlobals::getDefaultToken());
 
 } // namespace vk_api
 
+Q_DECLARE_METATYPE(vk_api::VkMessage)
+
 #endif // VKAPI_H
@@ -1,16 +1,34 @@
 #include "vkautoreplyer.h"
 #include "arma_logger.h"
-#include "languageprocessing.h"
 #include <QFile>
 
 using namespace arma_logger;
 using namespace vk_api;
 
+// capacity of queues between stages
+static const int queueCapacity = 1024;
+
+// how often queue depths are logged, ms
+static const int metricsInterval = 10000;
+
+// max amount of Callback API messages waiting for space in the pipeline
+static const int maxInbox = 10000;
+
 VkAutoReplyer::VkAutoReplyer(const QString &token,
                              const QString &loLangPath,
-                             int timerInterval):
+                             int timerInterval,
+                             const QString &outboxPath):
     token_(token),
-    loLangDbPath_(loLangPath)
+    loLangDbPath_(loLangPath),
+    fetched_(queueCapacity),
+    replies_(queueCapacity),
+    transitions_(queueCapacity),
+    fetchStage_(token, timerInterval, fetched_, inFlight_),
+    matchStage_(loLangPath, fetched_, replies_, transitions_, inFlight_),
+    sendStage_(token, outboxPath.isEmpty() ? loLangPath + ".outbox" : outboxPath,
+               replies_, transitions_, inFlight_),
+    inboxDropped_(0),
+    callbackMode_(false)
 {
     QFile f(loLangPath);
     if (!f.exists())
@@ -19,35 +37,120 @@ VkAutoReplyer::VkAutoReplyer(const QString &token,
         exit(1);
     }
 
-    timer_.setInterval(timerInterval);
+    // each stage wakes the one reading its output; send stage feeds state changes back to match stage
+    fetchStage_.setConsumer(&matchStage_);
+    matchStage_.setConsumer(&sendStage_);
+    sendStage_.setConsumer(&matchStage_);
 
-    connect(&timer_, &QTimer::timeout, this, &VkAutoReplyer::update);
+    inboxTimer_.setInterval(10);
+    connect(&inboxTimer_, &QTimer::timeout, this, &VkAutoReplyer::flushInbox);
+
+    metricsTimer_.setInterval(metricsInterval);
+    connect(&metricsTimer_, &QTimer::timeout, this, &VkAutoReplyer::reportMetrics);
+}
 
-    srand(time(0));
+VkAutoReplyer::~VkAutoReplyer()
+{
+    stop();
 }
 
 void VkAutoReplyer::start()
 {
-    timer_.start();
+    if (!callbackMode_)
+        fetchStage_.start();
+    if (shadow_)
+        shadow_->start();
+    matchStage_.start();
+    sendStage_.start();
+    metricsTimer_.start();
 }
 
-void VkAutoReplyer::update()
+void VkAutoReplyer::stop()
 {
-    QList<VkMessage> messages = getUnreadMessages(token_);
+    fetchStage_.stop();
+    // send stage goes first so match stage saves state changes of every admitted reply
+    sendStage_.stop();
+    matchStage_.stop();
+    if (shadow_)
+        shadow_->stop();
+    metricsTimer_.stop();
+}
 
-    for (const VkMessage& m: messages) {
-        QString reply = loLangGetReply(m.body, loLangDbPath_);
-        if (reply != "")
-        {
-            // mark as read
-            markAsRead(m.userId, m.id, token_);
-            // reply
-            sendMessage(reply, m.userId, token_);
+void VkAutoReplyer::setCallbackMode(bool callbackMode)
+{
+    callbackMode_ = callbackMode;
+}
 
-            // get sender name for log
-            VkUser sender = getUserById(m.userId, token_);
-            log(sender.firstName + " " + sender.lastName + ": " +
-                m.body + " --> " + reply, arma_logger::lpInfo);
-        }
+void VkAutoReplyer::setConversations(const QString &snapshotPath, int ttlSec)
+{
+    matchStage_.setConversations(snapshotPath, ttlSec);
+}
+
+bool VkAutoReplyer::setOverlays(const QString &manifestPath)
+{
+    return matchStage_.setOverlays(manifestPath);
+}
+
+void VkAutoReplyer::setShadow(const QString &candidatePath, const QString &reportPath)
+{
+    shadow_.reset(new ShadowEvaluator(loLangDbPath_, candidatePath, reportPath));
+    matchStage_.setShadow(shadow_.data());
+}
+
+void VkAutoReplyer::setAdmissionPolicy(const AdmissionPolicy &policy)
+{
+    sendStage_.setAdmissionPolicy(policy);
+}
+
+QVector<qint64> VkAutoReplyer::takePollLatencies()
+{
+    return fetchStage_.takePollLatencies();
+}
+
+void VkAutoReplyer::enqueue(const VkMessage &message)
+{
+    if (inbox_.isEmpty() && fetched_.tryPush(message))
+    {
+        matchStage_.wake();
+        return;
+    }
+
+    // storm of pushed messages: drop newest ones, they stay unread for a human to answer
+    if (inbox_.size() >= maxInbox)
+    {
+        ++inboxDropped_;
+        return;
     }
+
+    // keep order: once something is waiting, everything waits
+    inbox_.enqueue(message);
+    if (!inboxTimer_.isActive())
+        inboxTimer_.start();
+}
+
+void VkAutoReplyer::flushInbox()
+{
+    while (!inbox_.isEmpty() && fetched_.tryPush(inbox_.head()))
+        inbox_.dequeue();
+    matchStage_.wake();
+
+    if (inbox_.isEmpty())
+        inboxTimer_.stop();
+}
+
+void VkAutoReplyer::reportMetrics()
+{
+    log("pipeline: fetched " + QString::number(fetchStage_.processed())
+        + ", matched " + QString::number(matchStage_.processed())
+        + ", replied " + QString::number(sendStage_.processed())
+        + ", shed " + QString::number(sendStage_.shedCount())
+        + ", outbox " + QString::number(sendStage_.outboxSize())
+        + (shadow_ ? ", shadow " + QString::number(shadow_->processed()) : QString())
+        + "; queue depth fetch->match " + QString::number(fetched_.size())
+        + " (max " + QString::number(fetched_.takeHighWatermark()) + ")"
+        + ", match->send " + QString::number(replies_.size())
+        + " (max " + QString::number(replies_.takeHighWatermark()) + ")"
+        + (inbox_.isEmpty() ? QString() : ", callback inbox " + QString::number(inbox_.size()))
+        + (inboxDropped_ == 0 ? QString() : ", callback dropped " + QString::number(inboxDropped_)),
+        lpInfo);
 }
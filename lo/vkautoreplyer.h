@@ -3,8 +3,18 @@
 
 #include <QObject>
 #include <QTimer>
+#include <QQueue>
+#include <QScopedPointer>
 #include "vkapi.h"
+#include "replypipeline.h"
+#include "shadowevaluator.h"
 
+/**
+ * @brief The VkAutoReplyer class runs the reply pipeline:
+ * fetch (poll unread messages) -> match (find and generate reply) -> send (mark as read, reply).
+ * Each stage runs on its own thread; stages are connected by bounded lock-free queues,
+ * so a slow send doesn't delay fetching and matching overlaps network waits.
+ */
 class VkAutoReplyer: public QObject {
     Q_OBJECT
 
@@ -14,29 +24,94 @@ public:
      * @param token
      * @param loLangPath
      * @param timerInterval interval in milliseconds between checking for unread messages
+     * @param outboxPath file pending replies are persisted to; loLangPath + ".outbox" if empty
      */
     VkAutoReplyer( const QString& token = vk_api::VkGlobals::getDefaultToken(),
                    const QString& loLangPath = "/tmp/lolang.txt",
-                   int timerInterval = 1000
+                   int timerInterval = 1000,
+                   const QString& outboxPath = QString()
                   );
 
+    ~VkAutoReplyer();
+
     // starting autorepli
     void start();
 
-private:
-    // timer for updates
-    QTimer timer_;
+    // stops pipeline threads
+    void stop();
+
+    /// \brief messages will be taken from enqueue() instead of polling messages.get
+    void setCallbackMode(bool callbackMode);
+
+    /**
+     * @brief setConversations configures multi-turn rules; call before start()
+     * @param snapshotPath conversation states are kept in this file between runs
+     * @param ttlSec conversation is forgotten if peer doesn't write for that long
+     */
+    void setConversations(const QString& snapshotPath, int ttlSec);
+
+    /// \brief per-peer and per-account rules consulted before the base ones, see LoLangLayers; call before start()
+    /// \returns false if manifest can't be read
+    bool setOverlays(const QString& manifestPath);
+
+    /**
+     * @brief setShadow evaluates candidate patterns on every message alongside the active ones,
+     * never sending its replies; call before start()
+     * @param reportPath divergent replies, hit rates and match latencies are written there
+     */
+    void setShadow(const QString& candidatePath, const QString& reportPath);
+
+    /// \brief sets which replies are sent when there are more than the rate limit allows; call before start()
+    void setAdmissionPolicy(const AdmissionPolicy& policy);
+
+    /// \returns durations of message polls (microseconds) since the previous call
+    QVector<qint64> takePollLatencies();
+
+public slots:
+    /// \brief adds message pushed by Callback API to the pipeline
+    void enqueue(const vk_api::VkMessage& message);
 
+private slots:
+    // moves messages which didn't fit into the pipeline
+    void flushInbox();
+
+    // logs queue depths and processed counts of the stages
+    void reportMetrics();
+
+private:
     // application token
     QString token_;
 
     // path to file with loLang patterns
     QString loLangDbPath_;
 
-private slots:
+    InFlightRegistry inFlight_;
+
+    // fetch -> match; producer is fetch stage or, in callback mode, this object's thread
+    SpscQueue<vk_api::VkMessage> fetched_;
+
+    // match -> send
+    SpscQueue<ReplyTask> replies_;
+
+    // send -> match: conversation state changes of admitted replies
+    SpscQueue<StateTransition> transitions_;
+
+    FetchStage fetchStage_;
+    MatchStage matchStage_;
+    SendStage sendStage_;
+
+    // evaluates candidate patterns; null if shadow mode is off
+    QScopedPointer<ShadowEvaluator> shadow_;
+
+    // Callback API messages which didn't fit into the fetched_ queue
+    QQueue<vk_api::VkMessage> inbox_;
+    QTimer inboxTimer_;
+
+    // messages dropped because inbox_ was full
+    qint64 inboxDropped_;
 
-    // reads messages, marks as read and replies
-    void update();
+    QTimer metricsTimer_;
 
+    bool callbackMode_;
 };
 #endif // VKAUTOREPLYER_H
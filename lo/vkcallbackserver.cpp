@@ -0,0 +1,199 @@
+#include "vkcallbackserver.h"
+#include "arma_logger.h"
+#include <QTcpSocket>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+using namespace arma_logger;
+
+namespace vk_api {
+
+// requests larger than that are rejected
+static const int maxHeaderSize = 16 * 1024;
+static const int maxBodySize = 1024 * 1024;
+
+VkCallbackServer::VkCallbackServer(const QString &confirmationCode, const QString &secret, QObject *parent):
+    QObject(parent),
+    confirmationCode_(confirmationCode),
+    secret_(secret)
+{
+    connect(&server_, &QTcpServer::newConnection, this, &VkCallbackServer::onNewConnection);
+}
+
+bool VkCallbackServer::listen(quint16 port)
+{
+    if (!server_.listen(QHostAddress::Any, port))
+    {
+        log("callback server can't listen port " + QString::number(port) + ": " + server_.errorString(), lpError);
+        return false;
+    }
+    log("callback server listening on port " + QString::number(port), lpInfo);
+    return true;
+}
+
+quint16 VkCallbackServer::serverPort() const
+{
+    return server_.serverPort();
+}
+
+void VkCallbackServer::onNewConnection()
+{
+    while (QTcpSocket* socket = server_.nextPendingConnection())
+    {
+        buffers_.insert(socket, QByteArray());
+        connect(socket, &QTcpSocket::readyRead, this, &VkCallbackServer::onReadyRead);
+        connect(socket, &QTcpSocket::disconnected, this, &VkCallbackServer::onDisconnected);
+    }
+}
+
+void VkCallbackServer::onDisconnected()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    buffers_.remove(socket);
+    socket->deleteLater();
+}
+
+void VkCallbackServer::onReadyRead()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    QByteArray& buffer = buffers_[socket];
+    buffer += socket->readAll();
+
+    // there can be several pipelined requests in the buffer
+    while (true)
+    {
+        const int headerEnd = buffer.indexOf("\r\n\r\n");
+        if (headerEnd == -1)
+        {
+            if (buffer.size() > maxHeaderSize)
+            {
+                writeResponse(socket, 431, "header too large", false);
+                socket->disconnectFromHost();
+            }
+            return;
+        }
+
+        const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+        const QList<QByteArray> requestLine = lines[0].trimmed().split(' ');
+        int contentLength = 0;
+        bool keepAlive = requestLine.value(2) != "HTTP/1.0";
+        for (int i = 1; i < lines.size(); ++i)
+        {
+            const int colon = lines[i].indexOf(':');
+            const QByteArray name = lines[i].left(colon).trimmed().toLower();
+            const QByteArray value = lines[i].mid(colon + 1).trimmed().toLower();
+            if (name == "content-length")
+                contentLength = value.toInt();
+            else if (name == "connection")
+                keepAlive = (value == "keep-alive") || (keepAlive && value != "close");
+        }
+
+        if (contentLength < 0 || contentLength > maxBodySize)
+        {
+            writeResponse(socket, 413, "payload too large", false);
+            socket->disconnectFromHost();
+            return;
+        }
+
+        const int requestSize = headerEnd + 4 + contentLength;
+        if (buffer.size() < requestSize)
+            return; // wait for the rest of the body
+
+        const QByteArray body = buffer.mid(headerEnd + 4, contentLength);
+        buffer.remove(0, requestSize);
+
+        int status = 200;
+        QByteArray response;
+        if (requestLine.value(0) != "POST")
+        {
+            status = 405;
+            response = "method not allowed";
+        }
+        else
+        {
+            response = handleEvent(body, status);
+        }
+
+        writeResponse(socket, status, response, keepAlive);
+        if (!keepAlive)
+        {
+            socket->disconnectFromHost();
+            return;
+        }
+    }
+}
+
+QByteArray VkCallbackServer::handleEvent(const QByteArray &body, int &httpStatus)
+{
+    QJsonParseError e;
+    const QJsonObject event = QJsonDocument::fromJson(body, &e).object();
+    if (e.error != QJsonParseError::NoError)
+    {
+        log("callback server: error parsing event: " + e.errorString(), lpWarn);
+        httpStatus = 400;
+        return "bad request";
+    }
+
+    const QString type = event["type"].toString();
+
+    if (type == "confirmation")
+        return confirmationCode_.toUtf8();
+
+    if (!secret_.isEmpty() && event["secret"].toString() != secret_)
+    {
+        log("callback server: wrong secret in " + type + " event", lpWarn);
+        httpStatus = 403;
+        return "forbidden";
+    }
+
+    if (type == "message_new")
+    {
+        // since API 5.103 message is wrapped into "message" field
+        QJsonObject object = event["object"].toObject();
+        if (object.contains("message"))
+            object = object["message"].toObject();
+        emit messageReceived(VkMessage(object));
+    }
+
+    // vk repeats event until it gets "ok"
+    return "ok";
+}
+
+void VkCallbackServer::writeResponse(QTcpSocket *socket, int httpStatus, const QByteArray &body, bool keepAlive)
+{
+    QByteArray statusText;
+    switch (httpStatus) {
+    case 200:
+        statusText = "OK";
+        break;
+    case 400:
+        statusText = "Bad Request";
+        break;
+    case 403:
+        statusText = "Forbidden";
+        break;
+    case 405:
+        statusText = "Method Not Allowed";
+        break;
+    case 413:
+        statusText = "Payload Too Large";
+        break;
+    case 431:
+        statusText = "Request Header Fields Too Large";
+        break;
+    default:
+        statusText = "Error";
+        break;
+    }
+
+    QByteArray response;
+    response.reserve(128 + body.size());
+    response += "HTTP/1.1 " + QByteArray::number(httpStatus) + " " + statusText + "\r\n";
+    response += "Content-Type: text/plain\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    response += body;
+    socket->write(response);
+}
+
+} // namespace vk_api
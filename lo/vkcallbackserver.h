@@ -0,0 +1,67 @@
+/** \file      vkcallbackserver.h
+ *  \brief     Embedded HTTP server receiving Vk Callback API events
+ */
+#ifndef VKCALLBACKSERVER_H
+#define VKCALLBACKSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QHash>
+#include "vkapi.h"
+
+class QTcpSocket;
+
+namespace vk_api {
+
+/**
+ * @brief The VkCallbackServer class accepts Callback API events: https://vk.com/dev/callback_api
+ * Runs in the event loop of its thread, never blocks; supports HTTP/1.1 keep-alive.
+ * Answers confirmation request with confirmation code, checks secret key
+ * and emits messageReceived for every message_new event.
+ */
+class VkCallbackServer: public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @param confirmationCode string server should return on "confirmation" event
+     * @param secret secret key from community settings; empty string disables check
+     */
+    VkCallbackServer(const QString& confirmationCode, const QString& secret, QObject* parent = nullptr);
+
+    /// \returns false if port can't be listened; 0 lets the system choose a free port
+    bool listen(quint16 port);
+
+    /// \returns port the server is listening on
+    quint16 serverPort() const;
+
+signals:
+    void messageReceived(const vk_api::VkMessage& message);
+
+private slots:
+    void onNewConnection();
+
+    void onReadyRead();
+
+    void onDisconnected();
+
+private:
+    /// \returns response body for the event in request body; sets httpStatus
+    QByteArray handleEvent(const QByteArray& body, int& httpStatus);
+
+    static void writeResponse(QTcpSocket* socket, int httpStatus, const QByteArray& body, bool keepAlive);
+
+    QTcpServer server_;
+
+    QString confirmationCode_;
+
+    QString secret_;
+
+    // bytes received but not yet parsed, per connection
+    QHash<QTcpSocket*, QByteArray> buffers_;
+};
+
+} // namespace vk_api
+
+#endif // VKCALLBACKSERVER_H
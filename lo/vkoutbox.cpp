@@ -0,0 +1,219 @@
+#include "vkoutbox.h"
+#include "vkapi.h"
+#include "arma_logger.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <random>
+
+using namespace arma_logger;
+
+namespace vk_api {
+
+// first retry waits up to retryBaseMs, each next one up to twice as long, but not longer than retryMaxMs
+static const qint64 retryBaseMs = 1000;
+static const qint64 retryMaxMs = 5 * 60 * 1000;
+
+// reply is dropped after that many failed attempts
+static const int maxAttempts = 50;
+
+// journal is compacted when it has that many "done" records
+static const int compactThreshold = 1000;
+
+VkOutbox::VkOutbox(const QString &journalPath):
+    journalPath_(journalPath),
+    doneRecords_(0)
+{
+    if (journalPath_.isEmpty())
+        return;
+
+    load();
+    compact();
+}
+
+bool VkOutbox::add(qint32 userId, qint32 messageId, const QString &body, const QString &reply)
+{
+    const quint64 key = pendingKey(userId, messageId);
+    if (pendingKeys_.contains(key))
+        return false;
+
+    Entry e;
+    e.randomId = idempotencyKey(userId, messageId);
+    e.userId = userId;
+    e.messageId = messageId;
+    e.body = body;
+    e.reply = reply;
+    e.attempts = 0;
+    e.nextAttemptMs = 0;
+
+    appendJournal(addRecord(e));
+    entries_.push_back(e);
+    pendingKeys_.insert(key);
+    return true;
+}
+
+bool VkOutbox::sendNext(const QString &token)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    int index = 0;
+    while (index < entries_.size() && entries_[index].nextAttemptMs > now)
+        ++index;
+    if (index == entries_.size())
+        return false;
+
+    Entry& e = entries_[index];
+    SendResult result = sendMessage(e.reply, e.userId, e.randomId, token);
+
+    if (result == srSent)
+    {
+        // user id only: looking up the name would cost a request from the rate budget
+        log(QString::number(e.userId) + ": " + e.body + " --> " + e.reply, lpInfo);
+        finish(index);
+        return true;
+    }
+
+    if (result == srFailed || ++e.attempts >= maxAttempts)
+    {
+        log("can't send reply to " + QString::number(e.userId) + ", dropping it: " + e.reply, lpError);
+        finish(index);
+        return true;
+    }
+
+    // full jitter: random delay up to exponentially growing limit
+    static std::mt19937 engine(std::random_device{}());
+    const qint64 limit = qMin(retryMaxMs, retryBaseMs << qMin(e.attempts, 20));
+    const qint64 delay = std::uniform_int_distribution<qint64>(retryBaseMs / 2, limit)(engine);
+    e.nextAttemptMs = now + delay;
+
+    log("reply to " + QString::number(e.userId) + " will be retried in "
+        + QString::number(delay) + " ms (attempt " + QString::number(e.attempts) + ")", lpWarn);
+    return true;
+}
+
+int VkOutbox::size() const
+{
+    return entries_.size();
+}
+
+bool VkOutbox::hasDue() const
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (const Entry& e: entries_)
+        if (e.nextAttemptMs <= now)
+            return true;
+    return false;
+}
+
+qint32 VkOutbox::idempotencyKey(qint32 userId, qint32 messageId)
+{
+    const QByteArray hash = QCryptographicHash::hash(
+                QByteArray::number(userId) + ":" + QByteArray::number(messageId),
+                QCryptographicHash::Md5);
+    const quint32 key = (quint8(hash[0]) << 24 | quint8(hash[1]) << 16 | quint8(hash[2]) << 8 | quint8(hash[3]))
+            & 0x7fffffff;
+    return key == 0 ? 1 : qint32(key);
+}
+
+void VkOutbox::load()
+{
+    QFile file(journalPath_);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    while (!file.atEnd())
+    {
+        const QJsonObject record = QJsonDocument::fromJson(file.readLine()).object();
+        const QString op = record["op"].toString();
+        const qint32 userId = record["user_id"].toInt();
+        const qint32 messageId = record["message_id"].toInt();
+        const quint64 key = pendingKey(userId, messageId);
+
+        if (op == "add" && !pendingKeys_.contains(key))
+        {
+            Entry e;
+            e.randomId = record["random_id"].toInt();
+            e.userId = userId;
+            e.messageId = messageId;
+            e.body = record["body"].toString();
+            e.reply = record["reply"].toString();
+            e.attempts = 0;
+            e.nextAttemptMs = 0;
+            entries_.push_back(e);
+            pendingKeys_.insert(key);
+        }
+        else if (op == "done" && pendingKeys_.remove(key))
+        {
+            for (int i = 0; i < entries_.size(); ++i)
+                if (entries_[i].userId == userId && entries_[i].messageId == messageId)
+                {
+                    entries_.removeAt(i);
+                    break;
+                }
+        }
+        // anything else is a torn last line of a crashed run
+    }
+
+    if (!entries_.isEmpty())
+        log("outbox: " + QString::number(entries_.size()) + " replies left from previous run", lpInfo);
+}
+
+void VkOutbox::compact()
+{
+    journal_.close();
+
+    QSaveFile file(journalPath_);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        log("can't write outbox journal " + journalPath_, lpError);
+        return;
+    }
+    for (const Entry& e: entries_)
+        file.write(QJsonDocument(addRecord(e)).toJson(QJsonDocument::Compact) + "\n");
+    if (!file.commit())
+        log("can't write outbox journal " + journalPath_, lpError);
+
+    journal_.setFileName(journalPath_);
+    if (!journal_.open(QIODevice::WriteOnly | QIODevice::Append))
+        log("can't open outbox journal " + journalPath_, lpError);
+    doneRecords_ = 0;
+}
+
+void VkOutbox::appendJournal(const QJsonObject &record)
+{
+    if (!journal_.isOpen())
+        return;
+    journal_.write(QJsonDocument(record).toJson(QJsonDocument::Compact) + "\n");
+    journal_.flush();
+}
+
+void VkOutbox::finish(int index)
+{
+    const Entry e = entries_.takeAt(index);
+    pendingKeys_.remove(pendingKey(e.userId, e.messageId));
+
+    appendJournal(QJsonObject{{"op", "done"}, {"user_id", e.userId}, {"message_id", e.messageId}});
+
+    if (journal_.isOpen() && ++doneRecords_ >= compactThreshold)
+        compact();
+}
+
+quint64 VkOutbox::pendingKey(qint32 userId, qint32 messageId)
+{
+    return quint64(quint32(userId)) << 32 | quint32(messageId);
+}
+
+QJsonObject VkOutbox::addRecord(const Entry &e)
+{
+    return QJsonObject{
+        {"op", "add"},
+        {"random_id", e.randomId},
+        {"user_id", e.userId},
+        {"message_id", e.messageId},
+        {"body", e.body},
+        {"reply", e.reply}
+    };
+}
+
+} // namespace vk_api
@@ -0,0 +1,93 @@
+/** \file      vkoutbox.h
+ *  \brief     Durable queue of outgoing messages with retries
+ */
+#ifndef VKOUTBOX_H
+#define VKOUTBOX_H
+
+#include <QString>
+#include <QList>
+#include <QSet>
+#include <QFile>
+#include <QJsonObject>
+
+namespace vk_api {
+
+/**
+ * @brief The VkOutbox class keeps replies until vk accepts them.
+ * Pending sends are journaled to a file (JSON lines: "add" and "done" records)
+ * and restored on start. Failed sends are retried with jittered exponential backoff;
+ * every send carries random_id derived from the replied message, so a retry
+ * of a request that actually reached vk doesn't produce a second message.
+ */
+class VkOutbox
+{
+public:
+    /// \param journalPath file pending sends are persisted to; empty string keeps them in memory only
+    explicit VkOutbox(const QString& journalPath);
+
+    /**
+     * @brief add queues reply to a message
+     * @param body text of the message being replied, for log
+     * @return false if reply to this message is already queued
+     */
+    bool add(qint32 userId, qint32 messageId, const QString& body, const QString& reply);
+
+    /**
+     * @brief sendNext makes one attempt to send the first reply that is due
+     * @return false if there was no reply to send yet
+     */
+    bool sendNext(const QString& token);
+
+    /// \returns amount of pending sends
+    int size() const;
+
+    /// \returns true if some reply may be sent right now
+    bool hasDue() const;
+
+    /// \returns vk random_id for reply to the message: same message always gets the same id.
+    /// Different messages may share it, so it isn't used to detect duplicates
+    static qint32 idempotencyKey(qint32 userId, qint32 messageId);
+
+private:
+    struct Entry
+    {
+        qint32 randomId;
+        qint32 userId;
+        qint32 messageId;
+        QString body;
+        QString reply;
+        int attempts;
+        qint64 nextAttemptMs;
+    };
+
+    /// reads journal left by previous run
+    void load();
+
+    /// rewrites journal leaving only pending entries
+    void compact();
+
+    void appendJournal(const QJsonObject& record);
+
+    /// removes entry from the queue and journals it as done
+    void finish(int index);
+
+    static QJsonObject addRecord(const Entry& entry);
+
+    /// \returns exact key of the replied message
+    static quint64 pendingKey(qint32 userId, qint32 messageId);
+
+    QString journalPath_;
+    QFile journal_;
+
+    // "done" records written since last compaction
+    int doneRecords_;
+
+    QList<Entry> entries_;
+
+    // pendingKey of every entry
+    QSet<quint64> pendingKeys_;
+};
+
+} // namespace vk_api
+
+#endif // VKOUTBOX_H
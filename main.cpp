@@ -2,8 +2,15 @@
 #include <lo/arma_logger.h>
 #include <lo/languageprocessing.h>
 #include <lo/vkautoreplyer.h>
+#include <lo/traffictape.h>
+#include <lo/vkcallbackserver.h>
+#include <lo/sharedratelimiter.h>
+#include <lo/soakharness.h>
 #include <QCommandLineOption>
 #include <QCommandLineParser>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <ctime>
 
 using namespace arma_logger;
 
@@ -30,16 +37,88 @@ int main(int argc, char *argv[])
         {{"d", "delay"},
             QCoreApplication::translate("main", "Delay (in milliseconds) between requests"),
             QCoreApplication::translate("main", "delay")},
+        // pending replies journal
+        {{"o", "outbox"},
+            QCoreApplication::translate("main", "File pending replies are persisted to (default is <patterns>.outbox)"),
+            QCoreApplication::translate("main", "outbox")},
+        // overlay rules
+        {"overlays",
+            QCoreApplication::translate("main", "File listing per-peer and per-account patterns files consulted before the main one"),
+            QCoreApplication::translate("main", "file")},
+        // shadow evaluation
+        {"shadow",
+            QCoreApplication::translate("main", "Evaluate candidate patterns file on live messages without sending its replies"),
+            QCoreApplication::translate("main", "patterns")},
+        {"shadow-report",
+            QCoreApplication::translate("main", "Shadow evaluation report file (default is <candidate>.shadow.jsonl)"),
+            QCoreApplication::translate("main", "file")},
+        // multi-turn conversations
+        {"states",
+            QCoreApplication::translate("main", "File conversation states are saved to (default is <patterns>.states)"),
+            QCoreApplication::translate("main", "file")},
+        {"state-ttl",
+            QCoreApplication::translate("main", "Forget conversation after that many seconds of silence (default 3600)"),
+            QCoreApplication::translate("main", "seconds")},
+        // rate limit shared by local processes
+        {{"r", "rate"},
+            QCoreApplication::translate("main", "Max API requests per second per token for all local bot processes, 0 to disable (default 3)"),
+            QCoreApplication::translate("main", "rate")},
+        // admission control
+        {"max-age",
+            QCoreApplication::translate("main", "Don't answer messages older than that many seconds (default: no limit)"),
+            QCoreApplication::translate("main", "seconds")},
+        {"newest-first",
+            QCoreApplication::translate("main", "When behind, answer newest messages first")},
+        {"fair",
+            QCoreApplication::translate("main", "When behind, prefer peers who got fewer replies recently")},
+        {"max-pending",
+            QCoreApplication::translate("main", "Max replies waiting to be sent, the rest are dropped (default 10000)"),
+            QCoreApplication::translate("main", "count")},
+        // record API traffic
+        {"record",
+            QCoreApplication::translate("main", "Append API requests and responses (token redacted) to file"),
+            QCoreApplication::translate("main", "file")},
+        // replay API traffic
+        {"replay",
+            QCoreApplication::translate("main", "Serve API responses from recorded file instead of network"),
+            QCoreApplication::translate("main", "file")},
+        {"replay-speed",
+            QCoreApplication::translate("main", "Replay timing acceleration, 0 for no delays (default 1)"),
+            QCoreApplication::translate("main", "speed")},
+        // Callback API receiver
+        {"callback",
+            QCoreApplication::translate("main", "Receive messages via Callback API on this port instead of polling"),
+            QCoreApplication::translate("main", "port")},
+        {"confirmation",
+            QCoreApplication::translate("main", "String to return on Callback API confirmation request"),
+            QCoreApplication::translate("main", "code")},
+        {"secret",
+            QCoreApplication::translate("main", "Callback API secret key"),
+            QCoreApplication::translate("main", "secret")},
+        // random seed for reply generation
+        {"seed",
+            QCoreApplication::translate("main", "Seed for reply generation (default is current time)"),
+            QCoreApplication::translate("main", "seed")},
+        // soak run against local fake API
+        {"soak",
+            QCoreApplication::translate("main", "Run against local fake API for given minutes and check for resource drift"),
+            QCoreApplication::translate("main", "minutes")},
+        {"soak-drift",
+            QCoreApplication::translate("main", "Allowed growth of memory, descriptors and latency in soak run, % (default 20)"),
+            QCoreApplication::translate("main", "percent")},
     });
 
     // Process the actual command line arguments given by the user
     parser.process(app);
 
-    if (!parser.isSet("t")) {
+    const bool replay = parser.isSet("replay");
+    const bool soak = parser.isSet("soak");
+
+    if (!parser.isSet("t") && !replay && !soak) {
         log("Token is not set. Use \"" + app.applicationName() + " -t <token>\"", lpError);
         exit(1);
     }
-    QString token = parser.value("t");
+    QString token = parser.isSet("t") ? parser.value("t") : QString(soak ? "soak" : "replay");
 
     if (!parser.isSet("p")) {
         log("Patterns file is not set. Use \""
@@ -51,15 +130,110 @@ int main(int argc, char *argv[])
     int delay = parser.isSet("d") ? parser.value("d").toInt() : 1500;
     delay = std::max(delay, 1000);
 
+    double rate = parser.isSet("r") ? parser.value("r").toDouble() : 3;
+
+    // soak run polls local fake API as fast as asked and keeps its files in a temporary dir
+    QScopedPointer<FakeVkApi> fakeApi;
+    QScopedPointer<QTemporaryDir> soakDir;
+    QString outboxPath = parser.value("o");
+    QString statesPath = parser.isSet("states") ? parser.value("states") : patternsPath + ".states";
+    if (soak) {
+        fakeApi.reset(new FakeVkApi);
+        soakDir.reset(new QTemporaryDir);
+        if (!fakeApi->listen() || !soakDir->isValid())
+            exit(1);
+        vk_api::VkGlobals::setApiUrl(fakeApi->apiUrl());
+        delay = parser.isSet("d") ? parser.value("d").toInt() : 50;
+        rate = parser.isSet("r") ? rate : 0;
+        outboxPath = soakDir->filePath("outbox");
+        statesPath = soakDir->filePath("states");
+    }
+    vk_api::SharedRateLimiter::setRequestsPerSecond(rate);
+
+    quint32 seed = parser.isSet("seed") ? parser.value("seed").toUInt() : quint32(time(0));
+    loLangSetSeed(seed);
+
+    // offline replay must neither see nor touch pending replies and conversations of live runs
+    QScopedPointer<QTemporaryDir> replayDir;
+    if (replay) {
+        double speed = parser.isSet("replay-speed") ? parser.value("replay-speed").toDouble() : 1;
+        if (!vk_api::TrafficTape::startReplay(parser.value("replay"), speed))
+            exit(1);
+        delay = (speed > 0) ? int(delay / speed) : 0;
+
+        replayDir.reset(new QTemporaryDir);
+        if (!replayDir->isValid())
+            exit(1);
+        if (!parser.isSet("o"))
+            outboxPath = replayDir->filePath("outbox");
+        if (!parser.isSet("states"))
+            statesPath = replayDir->filePath("states");
+    }
+    else if (parser.isSet("record")) {
+        if (!vk_api::TrafficTape::startRecording(parser.value("record")))
+            exit(1);
+    }
+
     log("Starting VkAutoReplyer...", lpInfo);
     log("token = " + token.left(3) + "..." + token.right(3), lpInfo);
     log("path to reply patterns = " + patternsPath, lpInfo);
     log("delay = " + QString::number(delay) + " ms.", lpInfo);
+    log("seed = " + QString::number(seed), lpInfo);
+    log("rate limit = " + QString::number(rate) + " requests/sec", lpInfo);
+
+    VkAutoReplyer bot(token, patternsPath, delay, outboxPath);
+
+    if (parser.isSet("overlays") && !bot.setOverlays(parser.value("overlays")))
+        exit(1);
+
+    if (parser.isSet("shadow")) {
+        const QString candidate = parser.value("shadow");
+        bot.setShadow(candidate, parser.isSet("shadow-report") ? parser.value("shadow-report")
+                                                                : candidate + ".shadow.jsonl");
+    }
+
+    bot.setConversations(statesPath,
+                         parser.isSet("state-ttl") ? parser.value("state-ttl").toInt() : 3600);
+
+    AdmissionPolicy admission;
+    admission.maxAgeSec = parser.value("max-age").toInt();
+    admission.newestFirst = parser.isSet("newest-first");
+    admission.perPeerFairness = parser.isSet("fair");
+    if (parser.isSet("max-pending"))
+        admission.maxPending = parser.value("max-pending").toInt();
+    bot.setAdmissionPolicy(admission);
+
+    vk_api::VkCallbackServer callbackServer(parser.value("confirmation"), parser.value("secret"));
+    if (parser.isSet("callback")) {
+        if (!callbackServer.listen(parser.value("callback").toUShort()))
+            exit(1);
+        QObject::connect(&callbackServer, &vk_api::VkCallbackServer::messageReceived,
+                         &bot, &VkAutoReplyer::enqueue);
+        bot.setCallbackMode(true);
+    }
 
-    VkAutoReplyer bot(token, patternsPath, delay);
     bot.start();
 
     log("*** VkAutoReplyer running ***", lpInfo);
 
+    // replay ends with the tape
+    QTimer replayEndTimer;
+    if (replay) {
+        QObject::connect(&replayEndTimer, &QTimer::timeout, [&app]() {
+            if (vk_api::TrafficTape::isExhausted()) {
+                log("replay finished", lpInfo);
+                app.quit();
+            }
+        });
+        replayEndTimer.start(500);
+    }
+
+    QScopedPointer<SoakHarness> soakHarness;
+    if (soak) {
+        const double drift = parser.isSet("soak-drift") ? parser.value("soak-drift").toDouble() : 20;
+        soakHarness.reset(new SoakHarness(bot, *fakeApi, qint64(parser.value("soak").toDouble() * 60000), drift));
+        soakHarness->start();
+    }
+
     return app.exec();
 }
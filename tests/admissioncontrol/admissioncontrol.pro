@@ -0,0 +1,5 @@
+include(../common.pri)
+
+TARGET = tst_admissioncontrol
+
+SOURCES += tst_admissioncontrol.cpp
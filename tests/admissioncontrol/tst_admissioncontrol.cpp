@@ -0,0 +1,127 @@
+#include <QtTest>
+#include <lo/admissioncontrol.h>
+
+class TestAdmissionControl: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void priorityThenAge();
+    void newestFirst();
+    void perPeerFairness();
+    void overflowShedsLowestRanked();
+    void maxAgeShedsOldAndCountsOnce();
+
+private:
+    /// \param ageSec how long ago the message was written
+    static ReplyTask task(qint32 messageId, qint32 userId, int priority, qint64 ageSec = 0);
+
+    /// \returns ids of messages in the order controller admits them
+    static QList<qint32> drain(AdmissionController& controller);
+};
+
+ReplyTask TestAdmissionControl::task(qint32 messageId, qint32 userId, int priority, qint64 ageSec)
+{
+    ReplyTask t;
+    t.message.id = messageId;
+    t.message.userId = userId;
+    t.message.date = QDateTime::currentMSecsSinceEpoch() / 1000 - ageSec;
+    t.reply = "reply " + QString::number(messageId);
+    t.priority = priority;
+    return t;
+}
+
+QList<qint32> TestAdmissionControl::drain(AdmissionController &controller)
+{
+    QList<qint32> ids;
+    ReplyTask t;
+    QList<ReplyTask> shed;
+    while (controller.take(t, shed))
+        ids.push_back(t.message.id);
+    return ids;
+}
+
+void TestAdmissionControl::priorityThenAge()
+{
+    AdmissionController controller;
+    controller.offer(task(1, 10, 0, 30));
+    controller.offer(task(2, 11, 5, 10));
+    controller.offer(task(3, 12, 0, 60));
+    controller.offer(task(4, 13, 5, 20));
+
+    QCOMPARE(drain(controller), QList<qint32>({4, 2, 3, 1}));
+    QCOMPARE(controller.shedCount(), qint64(0));
+}
+
+void TestAdmissionControl::newestFirst()
+{
+    AdmissionPolicy policy;
+    policy.newestFirst = true;
+    AdmissionController controller(policy);
+    controller.offer(task(1, 10, 0, 30));
+    controller.offer(task(2, 11, 0, 10));
+    controller.offer(task(3, 12, 0, 60));
+
+    QCOMPARE(drain(controller), QList<qint32>({2, 1, 3}));
+}
+
+void TestAdmissionControl::perPeerFairness()
+{
+    AdmissionPolicy policy;
+    policy.perPeerFairness = true;
+    AdmissionController controller(policy);
+
+    // peer 10 writes a lot; peer 11 shouldn't wait for all of it
+    controller.offer(task(1, 10, 0, 50));
+    controller.offer(task(2, 10, 0, 40));
+    controller.offer(task(3, 10, 0, 30));
+    controller.offer(task(4, 11, 0, 20));
+
+    QCOMPARE(drain(controller), QList<qint32>({1, 4, 2, 3}));
+}
+
+void TestAdmissionControl::overflowShedsLowestRanked()
+{
+    AdmissionPolicy policy;
+    policy.maxPending = 2;
+    AdmissionController controller(policy);
+
+    QVERIFY(controller.offer(task(1, 10, 1, 10)).isEmpty());
+    QVERIFY(controller.offer(task(2, 11, 0, 20)).isEmpty());
+
+    const QList<ReplyTask> shed = controller.offer(task(3, 12, 2, 5));
+    QCOMPARE(shed.size(), 1);
+    QCOMPARE(shed.first().message.id, 2);
+    QCOMPARE(controller.size(), 2);
+    QCOMPARE(controller.shedCount(), qint64(1));
+
+    QCOMPARE(drain(controller), QList<qint32>({3, 1}));
+}
+
+void TestAdmissionControl::maxAgeShedsOldAndCountsOnce()
+{
+    AdmissionPolicy policy;
+    policy.maxAgeSec = 60;
+    policy.maxPending = 2;
+    AdmissionController controller(policy);
+
+    // send stage collects overflow sheds and passes the same list to take()
+    QList<ReplyTask> shed;
+    shed += controller.offer(task(1, 10, 0, 120));
+    shed += controller.offer(task(2, 11, 0, 90));
+    shed += controller.offer(task(3, 12, 1, 10));
+    QCOMPARE(shed.size(), 1);
+    QCOMPARE(shed.first().message.id, 2);
+    QCOMPARE(controller.shedCount(), qint64(1));
+
+    ReplyTask t;
+    QVERIFY(controller.take(t, shed));
+    QCOMPARE(t.message.id, 3);
+    QCOMPARE(shed.size(), 2);
+    QCOMPARE(controller.shedCount(), qint64(2));
+    QVERIFY(!controller.take(t, shed));
+}
+
+QTEST_MAIN(TestAdmissionControl)
+
+#include "tst_admissioncontrol.moc"
@@ -0,0 +1,45 @@
+# bot sources without main.cpp, shared by all test targets
+QT += core network testlib
+QT -= gui
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += \
+    $$PWD/../lo/arma_logger.cpp \
+    $$PWD/../lo/waitforsignalhelper.cpp \
+    $$PWD/../lo/vkapi.cpp \
+    $$PWD/../lo/languageprocessing.cpp \
+    $$PWD/../lo/vkautoreplyer.cpp \
+    $$PWD/../lo/traffictape.cpp \
+    $$PWD/../lo/vkcallbackserver.cpp \
+    $$PWD/../lo/sharedratelimiter.cpp \
+    $$PWD/../lo/replypipeline.cpp \
+    $$PWD/../lo/vkoutbox.cpp \
+    $$PWD/../lo/admissioncontrol.cpp \
+    $$PWD/../lo/peerstatetable.cpp \
+    $$PWD/../lo/rulelayers.cpp \
+    $$PWD/../lo/shadowevaluator.cpp \
+    $$PWD/../lo/soakharness.cpp
+
+HEADERS += \
+    $$PWD/../lo/arma_logger.h \
+    $$PWD/../lo/waitforsignalhelper.h \
+    $$PWD/../lo/vkapi.h \
+    $$PWD/../lo/languageprocessing.h \
+    $$PWD/../lo/vkautoreplyer.h \
+    $$PWD/../lo/traffictape.h \
+    $$PWD/../lo/vkcallbackserver.h \
+    $$PWD/../lo/sharedratelimiter.h \
+    $$PWD/../lo/spscqueue.h \
+    $$PWD/../lo/replypipeline.h \
+    $$PWD/../lo/vkoutbox.h \
+    $$PWD/../lo/admissioncontrol.h \
+    $$PWD/../lo/peerstatetable.h \
+    $$PWD/../lo/rulelayers.h \
+    $$PWD/../lo/shadowevaluator.h \
+    $$PWD/../lo/soakharness.h
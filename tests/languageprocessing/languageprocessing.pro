@@ -0,0 +1,5 @@
+include(../common.pri)
+
+TARGET = tst_languageprocessing
+
+SOURCES += tst_languageprocessing.cpp
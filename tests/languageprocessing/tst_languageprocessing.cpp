@@ -0,0 +1,94 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <lo/languageprocessing.h>
+
+class TestLanguageProcessing: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void normalize_data();
+    void normalize();
+
+    void cacheKeyKeepsStatesApart();
+
+    void fuzzyThreshold();
+
+private:
+    /// \returns path of a patterns file with given lines in dir
+    static QString writePatterns(const QTemporaryDir& dir, const QStringList& lines);
+};
+
+void TestLanguageProcessing::normalize_data()
+{
+    QTest::addColumn<QString>("input");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("case and yo") << QString::fromUtf8("Ёлка") << QString::fromUtf8("елка");
+    QTest::newRow("punctuation") << QString::fromUtf8("  Привет,   как дела?!  ") << QString::fromUtf8("привет как дела");
+    QTest::newRow("letter runs") << QString::fromUtf8("Приииивет!!!") << QString::fromUtf8("привет");
+    QTest::newRow("double letters") << "hello" << "hello";
+    QTest::newRow("digits") << QString::fromUtf8("1000 руб") << QString::fromUtf8("1000 руб");
+    QTest::newRow("emoji") << QString::fromUtf8("привет 😀👍") << QString::fromUtf8("привет");
+    QTest::newRow("only separators") << " !?. " << "";
+}
+
+void TestLanguageProcessing::normalize()
+{
+    QFETCH(QString, input);
+    QFETCH(QString, expected);
+    QCOMPARE(loLangNormalize(input), expected);
+}
+
+void TestLanguageProcessing::cacheKeyKeepsStatesApart()
+{
+    // state ids are given out in order, so the 9th name gets id 9 == '\t'
+    for (int i = 1; i <= 9; ++i)
+        loLangStateId("key-state-" + QString::number(i));
+    QCOMPARE(int(loLangStateId("key-state-9")), 9);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    LoLangRuleSet rules(writePatterns(dir, {
+        QString::fromUtf8("привет%in state%raw,state=key-state-9"),
+        QString::fromUtf8("привет%no state%raw")
+    }));
+    QVERIFY(rules.reloadIfChanged());
+
+    // raw rules make the lowered text a part of the key: "\tпривет" in state 0
+    // must not be confused with "привет" in state 9
+    QCOMPARE(rules.match(QString::fromUtf8("\tпривет"), 0), 1);
+    QCOMPARE(rules.match(QString::fromUtf8("привет"), 9), 0);
+    QCOMPARE(rules.match(QString::fromUtf8("\tпривет"), 0), 1);
+}
+
+void TestLanguageProcessing::fuzzyThreshold()
+{
+    // latin 'e' in place of cyrillic 'и': shares 3 of 6 trigrams with "привет", similarity 0.5
+    const QString typo = QString::fromUtf8("пр") + QLatin1Char('e') + QString::fromUtf8("вет");
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    LoLangRuleSet loose(writePatterns(dir, {QString::fromUtf8("привет%hi%fuzzy")}));
+    QCOMPARE(loose.match(typo), 0);
+    QCOMPARE(loose.match(QString::fromUtf8("Привет!!")), 0);
+    QCOMPARE(loose.match(QString::fromUtf8("пока")), -1);
+
+    LoLangRuleSet strict(writePatterns(dir, {QString::fromUtf8("привет%hi%fuzzy=0.6")}));
+    QCOMPARE(strict.match(typo), -1);
+    QCOMPARE(strict.match(QString::fromUtf8("привет")), 0);
+}
+
+QString TestLanguageProcessing::writePatterns(const QTemporaryDir &dir, const QStringList &lines)
+{
+    const QString path = dir.filePath("patterns.txt");
+    QFile f(path);
+    if (f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        f.write(lines.join('\n').toUtf8() + "\n");
+    return path;
+}
+
+QTEST_MAIN(TestLanguageProcessing)
+
+#include "tst_languageprocessing.moc"
@@ -0,0 +1,5 @@
+include(../common.pri)
+
+TARGET = tst_peerstatetable
+
+SOURCES += tst_peerstatetable.cpp
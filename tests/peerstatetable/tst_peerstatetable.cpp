@@ -0,0 +1,73 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <lo/peerstatetable.h>
+#include <lo/languageprocessing.h>
+
+class TestPeerStateTable: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void lookupProlongsTtl();
+    void manyPeers();
+    void snapshotOnlyWhenChanged();
+};
+
+void TestPeerStateTable::lookupProlongsTtl()
+{
+    PeerStateTable table(100);
+    const quint16 asked = loLangStateId("ttl-asked");
+    table.setState(1, asked, 1000);
+
+    // peer keeps writing: conversation lives on past the first TTL
+    QCOMPARE(table.state(1, 1090), asked);
+    QCOMPARE(table.state(1, 1180), asked);
+
+    // silence longer than TTL ends it
+    QCOMPARE(table.state(1, 1281), quint16(0));
+    QCOMPARE(table.size(), 0);
+}
+
+void TestPeerStateTable::manyPeers()
+{
+    PeerStateTable table(100);
+    const quint16 asked = loLangStateId("many-asked");
+    for (qint32 peer = 1; peer <= 5000; ++peer)
+        table.setState(peer, asked, 1000);
+    QCOMPARE(table.size(), 5000);
+
+    // ending every other conversation must not lose the rest (backward-shift delete)
+    for (qint32 peer = 1; peer <= 5000; peer += 2)
+        table.setState(peer, 0, 1000);
+    QCOMPARE(table.size(), 2500);
+    for (qint32 peer = 1; peer <= 5000; ++peer)
+        QCOMPARE(table.state(peer, 1001), peer % 2 ? quint16(0) : asked);
+}
+
+void TestPeerStateTable::snapshotOnlyWhenChanged()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath("states");
+
+    PeerStateTable table(100);
+    QVERIFY(!table.isChanged());
+    table.setState(7, loLangStateId("snapshot-asked"), 1000);
+    QVERIFY(table.isChanged());
+    QVERIFY(table.save(path));
+    QVERIFY(!table.isChanged());
+
+    PeerStateTable restored(100);
+    QVERIFY(restored.load(path, 1010));
+    QVERIFY(!restored.isChanged());
+    QCOMPARE(restored.state(7, 1010), loLangStateId("snapshot-asked"));
+
+    // expired by the time of loading
+    PeerStateTable late(100);
+    QVERIFY(late.load(path, 2000));
+    QCOMPARE(late.size(), 0);
+}
+
+QTEST_MAIN(TestPeerStateTable)
+
+#include "tst_peerstatetable.moc"
@@ -0,0 +1,5 @@
+include(../common.pri)
+
+TARGET = tst_rulelayers
+
+SOURCES += tst_rulelayers.cpp
@@ -0,0 +1,79 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <lo/rulelayers.h>
+
+class TestRuleLayers: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+
+    void peerThenAccountThenBase();
+    void sharedRuleSets();
+
+private:
+    void write(const QString& name, const QStringList& lines);
+
+    /// \returns reply pattern of the matched rule; empty string if nothing matched
+    static QString reply(LoLangLayers& layers, qint32 peerId, const QString& input);
+
+    QScopedPointer<QTemporaryDir> dir_;
+};
+
+void TestRuleLayers::init()
+{
+    dir_.reset(new QTemporaryDir);
+    QVERIFY(dir_->isValid());
+
+    write("base.txt", {QString::fromUtf8("привет%base hi"), QString::fromUtf8("пока%base bye")});
+    write("vip.txt", {QString::fromUtf8("привет%vip hi")});
+    write("account.txt", {QString::fromUtf8("привет%account hi"), QString::fromUtf8("как дела%account fine")});
+}
+
+void TestRuleLayers::write(const QString &name, const QStringList &lines)
+{
+    QFile f(dir_->filePath(name));
+    QVERIFY(f.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    f.write(lines.join('\n').toUtf8() + "\n");
+}
+
+QString TestRuleLayers::reply(LoLangLayers &layers, qint32 peerId, const QString &input)
+{
+    const LoLangRule* rule = layers.match(peerId, input);
+    return rule != nullptr ? rule->reply : QString();
+}
+
+void TestRuleLayers::peerThenAccountThenBase()
+{
+    // relative paths are relative to the manifest
+    write("overlays.txt", {"# vip user", "peer 5 vip.txt", "account account.txt"});
+
+    LoLangLayers layers(dir_->filePath("base.txt"));
+    QVERIFY(layers.setOverlays(dir_->filePath("overlays.txt")));
+
+    QCOMPARE(reply(layers, 5, QString::fromUtf8("Привет!")), QString("vip hi"));
+    QCOMPARE(reply(layers, 6, QString::fromUtf8("Привет!")), QString("account hi"));
+
+    // rules missing from a layer fall through to the next one
+    QCOMPARE(reply(layers, 5, QString::fromUtf8("как дела")), QString("account fine"));
+    QCOMPARE(reply(layers, 5, QString::fromUtf8("ну пока")), QString("base bye"));
+    QCOMPARE(reply(layers, 6, QString::fromUtf8("что нового")), QString());
+}
+
+void TestRuleLayers::sharedRuleSets()
+{
+    write("overlays.txt", {"peer 5 vip.txt", "peer 6 vip.txt", "peer 2000000001 vip.txt",
+                           "account account.txt"});
+
+    LoLangLayers layers(dir_->filePath("base.txt"));
+    QVERIFY(layers.setOverlays(dir_->filePath("overlays.txt")));
+
+    // three peers, one file: loaded once
+    QCOMPARE(layers.overlayCount(), 2);
+    QCOMPARE(layers.match(5, QString::fromUtf8("привет")), layers.match(2000000001, QString::fromUtf8("привет")));
+}
+
+QTEST_MAIN(TestRuleLayers)
+
+#include "tst_rulelayers.moc"
@@ -0,0 +1,5 @@
+include(../common.pri)
+
+TARGET = tst_shadowevaluator
+
+SOURCES += tst_shadowevaluator.cpp
@@ -0,0 +1,101 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <lo/shadowevaluator.h>
+
+class TestShadowEvaluator: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+
+    void divergenceRecords();
+
+private:
+    void write(const QString& name, const QStringList& lines);
+
+    /// \returns report records of the given type
+    QList<QJsonObject> records(const QString& type);
+
+    QScopedPointer<QTemporaryDir> dir_;
+};
+
+void TestShadowEvaluator::init()
+{
+    dir_.reset(new QTemporaryDir);
+    QVERIFY(dir_->isValid());
+
+    write("active.txt", {QString::fromUtf8("привет%hi"), QString::fromUtf8("пока%bye")});
+    write("candidate.txt", {QString::fromUtf8("привет%hello"), QString::fromUtf8("пока%bye"),
+                            QString::fromUtf8("как дела%fine")});
+}
+
+void TestShadowEvaluator::write(const QString &name, const QStringList &lines)
+{
+    QFile f(dir_->filePath(name));
+    QVERIFY(f.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    f.write(lines.join('\n').toUtf8() + "\n");
+}
+
+QList<QJsonObject> TestShadowEvaluator::records(const QString &type)
+{
+    QList<QJsonObject> result;
+    QFile f(dir_->filePath("report.jsonl"));
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+        return result;
+    while (!f.atEnd())
+    {
+        const QJsonObject record = QJsonDocument::fromJson(f.readLine()).object();
+        if (record.value("type").toString() == type)
+            result.append(record);
+    }
+    return result;
+}
+
+void TestShadowEvaluator::divergenceRecords()
+{
+    ShadowEvaluator shadow(dir_->filePath("active.txt"), dir_->filePath("candidate.txt"),
+                           dir_->filePath("report.jsonl"));
+
+    const QStringList bodies{QString::fromUtf8("Привет"), QString::fromUtf8("ну пока"),
+                             QString::fromUtf8("как дела?"), QString::fromUtf8("что нового")};
+    qint32 peerId = 1;
+    for (const QString& body: bodies)
+    {
+        ShadowSample s;
+        s.body = body;
+        s.peerId = peerId++;
+        QVERIFY(shadow.offer(s));
+    }
+
+    shadow.start();
+    QTRY_COMPARE(shadow.processed(), qint64(bodies.size()));
+    shadow.stop();
+
+    // same reply and no match on both sides aren't reported
+    const QList<QJsonObject> divergent = records("divergence");
+    QCOMPARE(divergent.size(), 2);
+
+    QCOMPARE(divergent[0].value("peer").toInt(), 1);
+    QCOMPARE(divergent[0].value("active").toString(), QString("hi"));
+    QCOMPARE(divergent[0].value("candidate").toString(), QString("hello"));
+    QVERIFY(divergent[0].value("latency_delta_us").isDouble());
+
+    // candidate matches what active rule set doesn't
+    QCOMPARE(divergent[1].value("peer").toInt(), 3);
+    QVERIFY(divergent[1].value("active").isNull());
+    QCOMPARE(divergent[1].value("candidate").toString(), QString("fine"));
+
+    // summary is written on stop
+    const QList<QJsonObject> summaries = records("summary");
+    QCOMPARE(summaries.size(), 1);
+    QCOMPARE(summaries[0].value("messages").toInt(), bodies.size());
+    QCOMPARE(summaries[0].value("divergent").toInt(), 2);
+    QCOMPARE(summaries[0].value("active_hit_rate").toDouble(), 0.5);
+    QCOMPARE(summaries[0].value("candidate_hit_rate").toDouble(), 0.75);
+}
+
+QTEST_MAIN(TestShadowEvaluator)
+
+#include "tst_shadowevaluator.moc"
@@ -0,0 +1,5 @@
+include(../common.pri)
+
+TARGET = tst_sharedratelimiter
+
+SOURCES += tst_sharedratelimiter.cpp
@@ -0,0 +1,119 @@
+#include <QtTest>
+#include <QProcess>
+#include <chrono>
+#include <iostream>
+#include <lo/sharedratelimiter.h>
+
+using namespace vk_api;
+
+// 20 requests per second: slots are 50 ms apart
+static const double testRate = 20;
+static const qint64 testIntervalUs = 50000;
+
+static qint64 nowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/// child process: waits until startUs, acquires count slots and prints the time of each
+static int acquireInChild(const QString& key, qint64 startUs, int count)
+{
+    SharedRateLimiter limiter(key, testRate);
+    if (startUs > nowUs())
+        QThread::usleep(ulong(startUs - nowUs()));
+    for (int i = 0; i < count; ++i)
+    {
+        limiter.acquire();
+        std::cout << nowUs() << std::endl;
+    }
+    return 0;
+}
+
+class TestSharedRateLimiter: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void spacesRequests();
+    void noBurstAfterIdle();
+    void sharedBetweenProcesses();
+
+private:
+    static QString uniqueKey(const QString& name);
+};
+
+QString TestSharedRateLimiter::uniqueKey(const QString &name)
+{
+    return "vkautoreply-rate-test-" + name + "-" + QString::number(QCoreApplication::applicationPid());
+}
+
+void TestSharedRateLimiter::spacesRequests()
+{
+    SharedRateLimiter limiter(uniqueKey("spaces"), testRate);
+
+    const qint64 start = nowUs();
+    for (int i = 0; i < 5; ++i)
+        limiter.acquire();
+
+    // first request goes right away, four more wait for their slots
+    QVERIFY(nowUs() - start >= 4 * testIntervalUs);
+}
+
+void TestSharedRateLimiter::noBurstAfterIdle()
+{
+    SharedRateLimiter limiter(uniqueKey("idle"), testRate);
+    limiter.acquire();
+    QThread::msleep(300);
+
+    // idle time is not saved up: second request after the pause still waits for the third
+    const qint64 start = nowUs();
+    limiter.acquire();
+    QVERIFY(nowUs() - start < testIntervalUs / 2);
+    limiter.acquire();
+    QVERIFY(nowUs() - start >= testIntervalUs - 1000);
+}
+
+void TestSharedRateLimiter::sharedBetweenProcesses()
+{
+    const QString key = uniqueKey("processes");
+    const int perProcess = 5;
+    const qint64 startUs = nowUs() + 500000;
+
+    // both children start acquiring at the same moment
+    QProcess first, second;
+    for (QProcess* p: {&first, &second})
+        p->start(QCoreApplication::applicationFilePath(),
+                 {"--acquire", key, QString::number(startUs), QString::number(perProcess)});
+    for (QProcess* p: {&first, &second})
+    {
+        QVERIFY(p->waitForFinished(10000));
+        QCOMPARE(p->exitCode(), 0);
+    }
+
+    QVector<qint64> times;
+    for (QProcess* p: {&first, &second})
+        for (const QByteArray& line: p->readAllStandardOutput().split('\n'))
+            if (!line.trimmed().isEmpty())
+                times.push_back(line.trimmed().toLongLong());
+    QCOMPARE(times.size(), 2 * perProcess);
+
+    // with separate limiters both processes would finish in 4 intervals; a shared one takes 9
+    std::sort(times.begin(), times.end());
+    QVERIFY2(times.last() - times.first() >= 8 * testIntervalUs,
+             qPrintable("span " + QString::number(times.last() - times.first()) + " us"));
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    const QStringList args = app.arguments();
+    if (args.value(1) == "--acquire")
+        return acquireInChild(args.value(2), args.value(3).toLongLong(), args.value(4).toInt());
+
+    TestSharedRateLimiter test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_sharedratelimiter.moc"
@@ -0,0 +1,10 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    admissioncontrol \
+    languageprocessing \
+    peerstatetable \
+    rulelayers \
+    shadowevaluator \
+    sharedratelimiter \
+    vkcallbackserver
@@ -0,0 +1,121 @@
+#include <QtTest>
+#include <QTcpSocket>
+#include <lo/vkcallbackserver.h>
+
+using namespace vk_api;
+
+class TestVkCallbackServer: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void confirmation();
+    void wrongSecret();
+    void messageNew();
+    void pipelinedRequests();
+    void onlyPost();
+
+private:
+    /// \returns raw http POST request with json body
+    static QByteArray post(const QByteArray& body);
+
+    /// sends request and \returns everything server answered until expectedResponses responses came
+    QByteArray exchange(VkCallbackServer& server, const QByteArray& request, int expectedResponses = 1);
+};
+
+void TestVkCallbackServer::initTestCase()
+{
+    qRegisterMetaType<vk_api::VkMessage>();
+}
+
+QByteArray TestVkCallbackServer::post(const QByteArray &body)
+{
+    return "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\nContent-Length: "
+            + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+}
+
+QByteArray TestVkCallbackServer::exchange(VkCallbackServer &server, const QByteArray &request, int expectedResponses)
+{
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    socket.write(request);
+
+    // server lives in this thread, so the event loop has to run while waiting
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    while (received.count("HTTP/1.1 ") < expectedResponses && timer.elapsed() < 5000)
+    {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+        received += socket.readAll();
+    }
+    return received;
+}
+
+void TestVkCallbackServer::confirmation()
+{
+    VkCallbackServer server("abc123", "secret");
+    QVERIFY(server.listen(0));
+
+    const QByteArray response = exchange(server, post(R"({"type":"confirmation","group_id":1})"));
+    QVERIFY(response.startsWith("HTTP/1.1 200"));
+    QVERIFY(response.endsWith("\r\n\r\nabc123"));
+}
+
+void TestVkCallbackServer::wrongSecret()
+{
+    VkCallbackServer server("abc123", "secret");
+    QVERIFY(server.listen(0));
+    QSignalSpy spy(&server, &VkCallbackServer::messageReceived);
+
+    const QByteArray response = exchange(server, post(
+        R"({"type":"message_new","secret":"wrong","object":{"message":{"id":5,"from_id":42,"peer_id":42,"text":"hi"}}})"));
+    QVERIFY(response.startsWith("HTTP/1.1 403"));
+    QCOMPARE(spy.count(), 0);
+}
+
+void TestVkCallbackServer::messageNew()
+{
+    VkCallbackServer server("abc123", "secret");
+    QVERIFY(server.listen(0));
+    QSignalSpy spy(&server, &VkCallbackServer::messageReceived);
+
+    const QByteArray response = exchange(server, post(
+        R"({"type":"message_new","secret":"secret","object":{"message":{"id":5,"from_id":42,"peer_id":42,"text":"hi"}}})"));
+    QVERIFY(response.startsWith("HTTP/1.1 200"));
+    QVERIFY(response.endsWith("\r\n\r\nok"));
+
+    QCOMPARE(spy.count(), 1);
+    const VkMessage m = spy.at(0).at(0).value<VkMessage>();
+    QCOMPARE(m.id, 5);
+    QCOMPARE(m.userId, 42);
+    QCOMPARE(m.chatId, 0);
+    QCOMPARE(m.body, QString("hi"));
+}
+
+void TestVkCallbackServer::pipelinedRequests()
+{
+    VkCallbackServer server("abc123", QString());
+    QVERIFY(server.listen(0));
+    QSignalSpy spy(&server, &VkCallbackServer::messageReceived);
+
+    const QByteArray event = R"({"type":"message_new","object":{"id":7,"user_id":1,"body":"a"}})";
+    const QByteArray response = exchange(server, post(event) + post(event), 2);
+    QCOMPARE(response.count("HTTP/1.1 200"), 2);
+    QCOMPARE(spy.count(), 2);
+}
+
+void TestVkCallbackServer::onlyPost()
+{
+    VkCallbackServer server("abc123", QString());
+    QVERIFY(server.listen(0));
+
+    const QByteArray response = exchange(server, "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    QVERIFY(response.startsWith("HTTP/1.1 405"));
+}
+
+QTEST_MAIN(TestVkCallbackServer)
+
+#include "tst_vkcallbackserver.moc"
@@ -0,0 +1,5 @@
+include(../common.pri)
+
+TARGET = tst_vkcallbackserver
+
+SOURCES += tst_vkcallbackserver.cpp